@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2015 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ histogram.cpp
+
+ Log-bucketed latency histogram
+ *****************************************************************************/
+
+#include <config.h>
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Values below 2^HISTOGRAM_SUB_BITS get a bucket of their own. Above that,
+// the top HISTOGRAM_SUB_BITS bits of the value select the bucket.
+static size_t getIndex(unsigned long long value)
+{
+	unsigned int shift = 0;
+
+	if (value >> HISTOGRAM_MAX_BITS) value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+
+	while (value >> (shift + HISTOGRAM_SUB_BITS)) shift++;
+
+	return shift * HISTOGRAM_HALF + (size_t)(value >> shift);
+}
+
+// The highest value that is counted in the bucket
+static unsigned long long getValue(size_t index)
+{
+	unsigned int shift;
+
+	if (index < 2 * HISTOGRAM_HALF) return index;
+
+	shift = index / HISTOGRAM_HALF - 1;
+
+	return ((unsigned long long)(index - shift * HISTOGRAM_HALF + 1) << shift) - 1;
+}
+
+void histogramReset(histogram_t* histogram)
+{
+	memset(histogram, 0, sizeof(histogram_t));
+}
+
+void histogramRecord(histogram_t* histogram, double seconds)
+{
+	unsigned long long value = 0;
+
+	if (seconds > 0) value = (unsigned long long)(seconds * 1000000000);
+
+	if (histogram->count == 0 || value < histogram->min) histogram->min = value;
+	if (value > histogram->max) histogram->max = value;
+	histogram->count++;
+	histogram->buckets[getIndex(value)]++;
+}
+
+// Record into a histogram that is shared by several threads
+void histogramRecordShared(histogram_t* histogram, double seconds)
+{
+	unsigned long long value = 0;
+	unsigned long long seen;
+
+	if (seconds > 0) value = (unsigned long long)(seconds * 1000000000);
+
+	// The first value sets the minimum, count is only raised afterwards
+	for (seen = histogram->min;
+	     value < seen || (seen == 0 && histogram->count == 0);
+	     seen = histogram->min)
+	{
+		if (__sync_bool_compare_and_swap(&histogram->min, seen, value)) break;
+	}
+	for (seen = histogram->max; value > seen; seen = histogram->max)
+	{
+		if (__sync_bool_compare_and_swap(&histogram->max, seen, value)) break;
+	}
+	__sync_fetch_and_add(&histogram->buckets[getIndex(value)], 1);
+	__sync_fetch_and_add(&histogram->count, 1);
+}
+
+void histogramMerge(histogram_t* histogram, const histogram_t* other)
+{
+	size_t i;
+
+	if (other->count == 0) return;
+
+	if (histogram->count == 0 || other->min < histogram->min) histogram->min = other->min;
+	if (other->max > histogram->max) histogram->max = other->max;
+	histogram->count += other->count;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		histogram->buckets[i] += other->buckets[i];
+	}
+}
+
+// Returns the latency in seconds below which the given percentage of the
+// values are found
+double histogramPercentile(const histogram_t* histogram, double percentile)
+{
+	unsigned long long value;
+	unsigned long rank, seen = 0;
+	double exact;
+	size_t i;
+
+	if (histogram->count == 0) return 0;
+
+	exact = histogram->count * percentile / 100;
+	rank = (unsigned long)exact;
+	if (rank < exact) rank++;
+	if (rank < 1) rank = 1;
+	if (rank > histogram->count) rank = histogram->count;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->buckets[i];
+		if (seen >= rank) break;
+	}
+
+	// The bucket may reach beyond the recorded values
+	value = getValue(i);
+	if (value > histogram->max) value = histogram->max;
+	if (value < histogram->min) value = histogram->min;
+
+	return value / 1000000000.0;
+}
+
+void histogramPrint(const char* label, const histogram_t* histogram)
+{
+	if (histogram->count == 0) return;
+
+	printf("%s latency: min %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+	       "p99.9 %.3f ms, max %.3f ms\n",
+	       label,
+	       histogram->min / 1000000.0,
+	       histogramPercentile(histogram, 50) * 1000,
+	       histogramPercentile(histogram, 90) * 1000,
+	       histogramPercentile(histogram, 99) * 1000,
+	       histogramPercentile(histogram, 99.9) * 1000,
+	       histogram->max / 1000000.0);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ histogram.h
+
+ Log-bucketed latency histogram. Each thread records into its own histogram,
+ so no locking is needed. The histograms are merged after the threads have
+ been joined. With many threads, a group of threads can share a histogram
+ and record into it with atomic operations instead.
+ *****************************************************************************/
+
+#ifndef _P11SPEED_HISTOGRAM_H
+#define _P11SPEED_HISTOGRAM_H
+
+// The values are recorded in nanoseconds. Each power of two is split into
+// 64 linear buckets, which gives a relative precision of about 1.6 percent.
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_HALF (1 << (HISTOGRAM_SUB_BITS - 1))
+// Values up to 2^40 ns (about 18 minutes)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_HALF)
+
+typedef struct histogram_t {
+	unsigned long count;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+void histogramReset(histogram_t* histogram);
+void histogramRecord(histogram_t* histogram, double seconds);
+void histogramRecordShared(histogram_t* histogram, double seconds);
+void histogramMerge(histogram_t* histogram, const histogram_t* other);
+double histogramPercentile(const histogram_t* histogram, double percentile);
+void histogramPrint(const char* label, const histogram_t* histogram);
+
+#endif // !_P11SPEED_HISTOGRAM_H
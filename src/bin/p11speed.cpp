@@ -34,6 +34,8 @@
 #include <config.h>
 #include "p11speed.h"
 #include "getpw.h"
+#include "histogram.h"
+#include "placement.h"
 #include "library.h"
 
 #include <stdio.h>
@@ -46,10 +48,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #endif
+#include <time.h>
+#include <errno.h>
 #include <iostream>
 #include <fstream>
 #include <pthread.h>
+#include <sched.h>
+#include <math.h>
 
 // Display the usage
 void usage()
@@ -57,61 +65,299 @@ void usage()
 	printf("Speed test for PKCS#11\n");
 	printf("Usage: p11speed [ACTION] [OPTIONS]\n");
 	printf("Action:\n");
+	printf("  --decrypt          Performe decryption speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --data-size, --chunk-size,\n");
+	printf("                     --threads and --iterations\n");
+	printf("                     The RSA_* mechanisms use --oaep-hash and\n");
+	printf("                     --oaep-mgf instead of --data-size and\n");
+	printf("                     --chunk-size\n");
+	printf("  --derive           Performe ECDH key derivation speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --threads and --iterations\n");
+	printf("  --digest           Performe digest speed test.\n");
+	printf("                     Use with --slot, --mechanism, --data-size,\n");
+	printf("                     --chunk-size, --threads and --iterations\n");
+	printf("  --encrypt          Performe encryption speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --data-size, --chunk-size,\n");
+	printf("                     --threads and --iterations\n");
 	printf("  -h                 Shows this help screen.\n");
 	printf("  --help             Shows this help screen.\n");
-	printf("  --sign             Performe signature speed test.\n");
+	printf("  --hmac             Performe HMAC speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --data-size, --chunk-size,\n");
+	printf("                     --threads and --iterations\n");
+	printf("  --keygen           Performe key pair generation speed test.\n");
 	printf("                     Use with --slot, --pin, --mechanism,\n");
 	printf("                     --keysize, --threads and --iterations\n");
+	printf("  --random           Performe random number generation speed test.\n");
+	printf("                     Use with --slot, --data-size, --threads\n");
+	printf("                     and --iterations\n");
+	printf("  --sign             Performe signature speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --data-size, --chunk-size,\n");
+	printf("                     --threads and --iterations\n");
 	printf("  --show-slots       Display all the available slots.\n");
+	printf("  --unwrap           Performe key unwrap speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --threads and --iterations\n");
+	printf("  --verify           Performe verification speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --data-size, --chunk-size,\n");
+	printf("                     --threads and --iterations\n");
+	printf("  --wrap             Performe key wrap speed test.\n");
+	printf("                     Use with --slot, --pin, --mechanism,\n");
+	printf("                     --keysize, --threads and --iterations\n");
 	printf("  -v                 Show version info.\n");
 	printf("  --version          Show version info.\n");
 	printf("Options:\n");
+	printf("  --chunk-size <nr>  The chunk size in bytes for multi-part operations.\n");
+	printf("  --compare <trials> Sign/Verify: compare two modules or two slots, A\n");
+	printf("                     and B, by alternating this number of trials.\n");
+	printf("  --cpu-list <list>  Pin the threads round-robin to these CPUs, e.g. 0-3,8.\n");
+	printf("  --cpu-spread <how> Pin the threads round-robin to one CPU per core\n");
+	printf("                     (core) or to the CPUs of each NUMA node (numa).\n");
+	printf("  --data-size <nr>   The data size in bytes, default is a range of sizes.\n");
+	printf("  --duration <sec>   Sign/Verify: run for a number of seconds instead\n");
+	printf("                     of a number of iterations.\n");
 	printf("  --iterations <nr>  The number of iterations per thread.\n");
+	printf("  --key-distribution <dist>\n");
+	printf("                     Sign/Verify: how the key of each operation is\n");
+	printf("                     picked: roundrobin (default), uniform, zipf:<s>\n");
+	printf("  --keys <nr>        Sign/Verify: the number of keys, default is 1.\n");
 	printf("  --keysize <bits>   Select key size in bits.\n");
-	printf("  --module <path>    Use another PKCS#11 library than SoftHSM.\n");
 	printf("  --mechanism <mech> Use this mechanism for the speed test.\n");
-	printf("                     Sign: RSA_PKCS  [1024-4096]\n");
-	printf("                           DSA       [1024-4096]\n");
-	printf("                           ECDSA     [256,384]\n");
-	printf("                           GOSTR3410\n");
+	printf("                     Sign/Verify/Keygen: RSA_PKCS  [1024-4096]\n");
+	printf("                                         DSA       [1024-4096]\n");
+	printf("                                         ECDSA     [256,384]\n");
+	printf("                                         GOSTR3410\n");
+	printf("                     Sign/Verify with a message of --data-size\n");
+	printf("                     bytes, default 1024:\n");
+	printf("                       SHA1_RSA_PKCS, SHA256_RSA_PKCS,\n");
+	printf("                       SHA384_RSA_PKCS, SHA512_RSA_PKCS,\n");
+	printf("                       SHA1_RSA_PKCS_PSS, SHA256_RSA_PKCS_PSS,\n");
+	printf("                       SHA384_RSA_PKCS_PSS, SHA512_RSA_PKCS_PSS\n");
+	printf("                       [1024-4096]\n");
+	printf("                       ECDSA_SHA1, ECDSA_SHA256, ECDSA_SHA384,\n");
+	printf("                       ECDSA_SHA512 [256,384]\n");
+	printf("                       EDDSA [255,448]\n");
+	printf("                     Derive: ECDH1_DERIVE [256,384]\n");
+	printf("                     Wrap/Unwrap: AES_KEY_WRAP     [128,192,256]\n");
+	printf("                                  AES_KEY_WRAP_PAD [128,192,256]\n");
+	printf("                                  RSA_PKCS_OAEP    [1024-4096]\n");
+	printf("                     Encrypt/Decrypt: AES_CBC [128,192,256]\n");
+	printf("                                      AES_CTR [128,192,256]\n");
+	printf("                                      AES_GCM [128,192,256]\n");
+	printf("                     Decrypt: RSA_PKCS      [1024-4096]\n");
+	printf("                              RSA_PKCS_OAEP [1024-4096]\n");
+	printf("                     Digest: SHA1, SHA256, SHA384, SHA512,\n");
+	printf("                             GOSTR3411\n");
+	printf("                     HMAC: SHA1_HMAC, SHA256_HMAC, SHA384_HMAC,\n");
+	printf("                           SHA512_HMAC, GOSTR3411_HMAC\n");
+	printf("                           [8-4096, default 256]\n");
 	printf("  --module <path>    Use another PKCS#11 library than SoftHSM.\n");
+	printf("                     Sign/Verify: repeat to run several libraries\n");
+	printf("                     at the same time, each with its own threads.\n");
+	printf("  --nice <level>     Run the threads at this nice level.\n");
+	printf("  --oaep-hash <hash> The OAEP hash: SHA1, SHA256, SHA384, SHA512.\n");
+	printf("                     Default is SHA1.\n");
+	printf("  --oaep-mgf <hash>  The MGF1 hash for OAEP, default is the OAEP hash.\n");
 	printf("  --pin <PIN>        The PIN for the normal user.\n");
+	printf("  --processes <nr>   Sign/Verify: run the threads in each of this number\n");
+	printf("                     of processes, which load the module on their own.\n");
+	printf("  --rate <ops/s>     Sign/Verify: start the operations on a fixed\n");
+	printf("                     timetable, spread across the threads.\n");
+	printf("  --sched-fifo <prio>\n");
+	printf("                     Run the threads under SCHED_FIFO at this priority.\n");
+	printf("  --sessions <nr>    Sign/Verify: share this number of sessions between\n");
+	printf("                     the threads instead of one session per thread.\n");
+	printf("                     With a list of slots, the number per slot.\n");
 	printf("  --slot <number>    The slot where the token is located.\n");
+	printf("                     Sign/Verify: a comma-separated list of slots\n");
+	printf("                     shares the work between the slots. Repeat to\n");
+	printf("                     give the slots of each --module.\n");
+	printf("  --stack-size <KB>  The stack size of each thread, default is the\n");
+	printf("                     system default. Small stacks allow many threads.\n");
+	printf("  --sweep-threads <[min..]max>\n");
+	printf("                     Sign/Verify: run with a doubling number of threads\n");
+	printf("                     and report where the throughput saturates.\n");
+	printf("  --target-p99 <ms>  Sign/Verify: search the number of threads, up to\n");
+	printf("                     --threads, and sessions with the highest\n");
+	printf("                     throughput whose p99 latency meets the target.\n");
 	printf("  --threads <number> The number of threads.\n");
+	printf("  --warmup <sec>     Operations during the first seconds of\n");
+	printf("                     --duration are not counted, default is 0.\n");
 }
 
 // Enumeration of the long options
 enum {
-	OPT_HELP = 0x100,
+	OPT_CHUNK_SIZE = 0x100,
+	OPT_COMPARE,
+	OPT_CPU_LIST,
+	OPT_CPU_SPREAD,
+	OPT_DATA_SIZE,
+	OPT_DECRYPT,
+	OPT_DERIVE,
+	OPT_DIGEST,
+	OPT_DURATION,
+	OPT_ENCRYPT,
+	OPT_HELP,
+	OPT_HMAC,
 	OPT_ITERATIONS,
+	OPT_KEY_DISTRIBUTION,
+	OPT_KEYGEN,
+	OPT_KEYS,
 	OPT_KEYSIZE,
 	OPT_MECHANISM,
 	OPT_MODULE,
+	OPT_NICE,
+	OPT_OAEP_HASH,
+	OPT_OAEP_MGF,
 	OPT_PIN,
+	OPT_PROCESSES,
+	OPT_RANDOM,
+	OPT_RATE,
+	OPT_SCHED_FIFO,
+	OPT_SESSIONS,
 	OPT_SHOW_SLOTS,
 	OPT_SIGN,
 	OPT_SLOT,
+	OPT_STACK_SIZE,
+	OPT_SWEEP_THREADS,
+	OPT_TARGET_P99,
 	OPT_THREADS,
-	OPT_VERSION
+	OPT_UNWRAP,
+	OPT_VERIFY,
+	OPT_VERSION,
+	OPT_WARMUP,
+	OPT_WRAP
 };
 
 // Text representation of the long options
 static const struct option long_options[] = {
+	{ "chunk-size",      1, NULL, OPT_CHUNK_SIZE },
+	{ "compare",         1, NULL, OPT_COMPARE },
+	{ "cpu-list",        1, NULL, OPT_CPU_LIST },
+	{ "cpu-spread",      1, NULL, OPT_CPU_SPREAD },
+	{ "data-size",       1, NULL, OPT_DATA_SIZE },
+	{ "decrypt",         0, NULL, OPT_DECRYPT },
+	{ "derive",          0, NULL, OPT_DERIVE },
+	{ "digest",          0, NULL, OPT_DIGEST },
+	{ "duration",        1, NULL, OPT_DURATION },
+	{ "encrypt",         0, NULL, OPT_ENCRYPT },
 	{ "help",            0, NULL, OPT_HELP },
+	{ "hmac",            0, NULL, OPT_HMAC },
 	{ "iterations",      1, NULL, OPT_ITERATIONS },
+	{ "key-distribution", 1, NULL, OPT_KEY_DISTRIBUTION },
+	{ "keygen",          0, NULL, OPT_KEYGEN },
+	{ "keys",            1, NULL, OPT_KEYS },
 	{ "keysize",         1, NULL, OPT_KEYSIZE },
 	{ "mechanism",       1, NULL, OPT_MECHANISM },
 	{ "module",          1, NULL, OPT_MODULE },
+	{ "nice",            1, NULL, OPT_NICE },
+	{ "oaep-hash",       1, NULL, OPT_OAEP_HASH },
+	{ "oaep-mgf",        1, NULL, OPT_OAEP_MGF },
 	{ "pin",             1, NULL, OPT_PIN },
+	{ "processes",       1, NULL, OPT_PROCESSES },
+	{ "random",          0, NULL, OPT_RANDOM },
+	{ "rate",            1, NULL, OPT_RATE },
+	{ "sched-fifo",      1, NULL, OPT_SCHED_FIFO },
+	{ "sessions",        1, NULL, OPT_SESSIONS },
 	{ "show-slots",      0, NULL, OPT_SHOW_SLOTS },
 	{ "sign",            0, NULL, OPT_SIGN },
 	{ "slot",            1, NULL, OPT_SLOT },
+	{ "stack-size",      1, NULL, OPT_STACK_SIZE },
+	{ "sweep-threads",   1, NULL, OPT_SWEEP_THREADS },
+	{ "target-p99",      1, NULL, OPT_TARGET_P99 },
 	{ "threads",         1, NULL, OPT_THREADS },
+	{ "unwrap",          0, NULL, OPT_UNWRAP },
+	{ "verify",          0, NULL, OPT_VERIFY },
 	{ "version",         0, NULL, OPT_VERSION },
+	{ "warmup",          1, NULL, OPT_WARMUP },
+	{ "wrap",            0, NULL, OPT_WRAP },
 	{ NULL,              0, NULL, 0 }
 };
 
 CK_FUNCTION_LIST_PTR p11;
+static sign_process_t signProcess;
+// Zero is the default stack size
+static size_t threadStackSize = 0;
+
+// The thread that is running a worker, for countOperation()
+static __thread thread_start_t* currentThread = NULL;
+
+// SHA256(p11speed)= f2c55b2f6a9dc972d444278810c226faf22ff96b1abd248f0118fa700e2aed72
+static CK_BYTE data256[] = { 0xf2, 0xc5, 0x5b, 0x2f, 0x6a, 0x9d, 0xc9, 0x72, 0xd4, 0x44,
+			     0x27, 0x88, 0x10, 0xc2, 0x26, 0xfa, 0xf2, 0x2f, 0xf9, 0x6b,
+			     0x1a, 0xbd, 0x24, 0x8f, 0x01, 0x18, 0xfa, 0x70, 0x0e, 0x2a,
+			     0xed, 0x72 };
+// SHA384(p11speed)= 3aec14e31d63ff1f9b2afe7e51fa7fe79926466c80a5aea185a2112df6d31f7c7cd9fffe3bdcc04dcf02010316ab340f
+static CK_BYTE data384[] = { 0x3a, 0xec, 0x14, 0xe3, 0x1d, 0x63, 0xff, 0x1f, 0x9b, 0x2a,
+			     0xfe, 0x7e, 0x51, 0xfa, 0x7f, 0xe7, 0x99, 0x26, 0x46, 0x6c,
+			     0x80, 0xa5, 0xae, 0xa1, 0x85, 0xa2, 0x11, 0x2d, 0xf6, 0xd3,
+			     0x1f, 0x7c, 0x7c, 0xd9, 0xff, 0xfe, 0x3b, 0xdc, 0xc0, 0x4d,
+			     0xcf, 0x02, 0x01, 0x03, 0x16, 0xab, 0x34, 0x0f };
+// GOSTR3411(p11speed)= 286e36119111e58338af8a821fff332d2211897f35dedcbaba488876b352553c
+static CK_BYTE dataGost[] = { 0x28, 0x6e, 0x36, 0x11, 0x91, 0x11, 0xe5, 0x83, 0x38, 0xaf,
+			      0x8a, 0x82, 0x1f, 0xff, 0x33, 0x2d, 0x22, 0x11, 0x89, 0x7f,
+			      0x35, 0xde, 0xdc, 0xba, 0xba, 0x48, 0x88, 0x76, 0xb3, 0x52,
+			      0x55, 0x3c };
+
+// The signing mechanisms, their key type and the pre-defined hash value
+// they sign. Mechanisms without a hash value sign a message of --data-size.
+static const struct {
+	const char* name;
+	CK_MECHANISM_TYPE mechanismType;
+	CK_KEY_TYPE keyType;
+	HashAlgo::Type hashType;
+} sign_mechanisms[] = {
+	{ "RSA_PKCS",            CKM_RSA_PKCS,            CKK_RSA,        HashAlgo::SHA256 },
+	{ "SHA1_RSA_PKCS",       CKM_SHA1_RSA_PKCS,       CKK_RSA,        HashAlgo::None   },
+	{ "SHA256_RSA_PKCS",     CKM_SHA256_RSA_PKCS,     CKK_RSA,        HashAlgo::None   },
+	{ "SHA384_RSA_PKCS",     CKM_SHA384_RSA_PKCS,     CKK_RSA,        HashAlgo::None   },
+	{ "SHA512_RSA_PKCS",     CKM_SHA512_RSA_PKCS,     CKK_RSA,        HashAlgo::None   },
+	{ "SHA1_RSA_PKCS_PSS",   CKM_SHA1_RSA_PKCS_PSS,   CKK_RSA,        HashAlgo::None   },
+	{ "SHA256_RSA_PKCS_PSS", CKM_SHA256_RSA_PKCS_PSS, CKK_RSA,        HashAlgo::None   },
+	{ "SHA384_RSA_PKCS_PSS", CKM_SHA384_RSA_PKCS_PSS, CKK_RSA,        HashAlgo::None   },
+	{ "SHA512_RSA_PKCS_PSS", CKM_SHA512_RSA_PKCS_PSS, CKK_RSA,        HashAlgo::None   },
+	{ "DSA",                 CKM_DSA,                 CKK_DSA,        HashAlgo::SHA256 },
+	{ "ECDSA",               CKM_ECDSA,               CKK_EC,         HashAlgo::SHA256 },
+	{ "ECDSA_SHA1",          CKM_ECDSA_SHA1,          CKK_EC,         HashAlgo::None   },
+	{ "ECDSA_SHA256",        CKM_ECDSA_SHA256,        CKK_EC,         HashAlgo::None   },
+	{ "ECDSA_SHA384",        CKM_ECDSA_SHA384,        CKK_EC,         HashAlgo::None   },
+	{ "ECDSA_SHA512",        CKM_ECDSA_SHA512,        CKK_EC,         HashAlgo::None   },
+	{ "EDDSA",               CKM_EDDSA,               CKK_EC_EDWARDS, HashAlgo::None   },
+	{ "GOSTR3410",           CKM_GOSTR3410,           CKK_GOSTR3410,  HashAlgo::GOST   }
+};
+
+// The hash and MGF names that can be used with OAEP
+static const struct {
+	const char* name;
+	CK_MECHANISM_TYPE hashAlg;
+	CK_ULONG mgf;
+} oaep_hashes[] = {
+	{ "SHA1",   CKM_SHA_1,  CKG_MGF1_SHA1   },
+	{ "SHA256", CKM_SHA256, CKG_MGF1_SHA256 },
+	{ "SHA384", CKM_SHA384, CKG_MGF1_SHA384 },
+	{ "SHA512", CKM_SHA512, CKG_MGF1_SHA512 }
+};
+
+// The data sizes used by the bulk benchmarks if no --data-size is given
+static const CK_ULONG bulk_sizes[] = { 16, 64, 256, 1024, 8192, 65536,
+				       1048576, 4194304 };
+
+// Text representation of the bulk operations
+static const char* bulk_operations[] = { "encryptions", "decryptions",
+					 "digests", "MACs", "random calls" };
+static const char* bulk_units[] = { "op/s", "op/s", "op/s", "op/s", "calls/s" };
+static const char* bulk_functions[][4] = {
+	{ "C_EncryptInit", "C_Encrypt", "C_EncryptUpdate", "C_EncryptFinal" },
+	{ "C_DecryptInit", "C_Decrypt", "C_DecryptUpdate", "C_DecryptFinal" },
+	{ "C_DigestInit", "C_Digest", "C_DigestUpdate", "C_DigestFinal" },
+	{ "C_SignInit", "C_Sign", "C_SignUpdate", "C_SignFinal" },
+	{ NULL, "C_GenerateRandom", NULL, NULL }
+};
 
 // The main function
 int main(int argc, char* argv[])
@@ -119,21 +365,54 @@ int main(int argc, char* argv[])
 	int option_index = 0;
 	int opt;
 
-	char* errMsg = NULL;
+	char* chunksize = NULL;
+	char* datasize = NULL;
+	char* duration = NULL;
 	char* iterations = NULL;
 	char* keysize = NULL;
 	char* mechanism = NULL;
-	char* module = NULL;
+	module_t moduleList[MODULES_MAX];
+	unsigned int moduleCount = 0;
+	unsigned int m;
+	char* oaephash = NULL;
+	char* oaepmgf = NULL;
+	char* rate = NULL;
+	char* sweep = NULL;
+	char* compare = NULL;
+	char* target = NULL;
+	char* processes = NULL;
+	char* stacksize = NULL;
+	char* cpulist = NULL;
+	char* cpuspread = NULL;
+	char* schedfifo = NULL;
+	char* nicelevel = NULL;
+	char* sessions = NULL;
+	char* keys = NULL;
+	char* distribution = NULL;
+	unsigned int sweepMin = 0;
+	unsigned int sweepMax = 0;
 	char* slot = NULL;
+	char* slotArgs[MODULES_MAX];
+	unsigned int slotArgCount = 0;
 	char* threads = NULL;
 	char* userPIN = NULL;
+	char* warmup = NULL;
 
 	int doShowSlots = 0;
 	int doSign = 0;
+	int doVerify = 0;
+	int doEncrypt = 0;
+	int doDecrypt = 0;
+	int doDigest = 0;
+	int doHmac = 0;
+	int doKeygen = 0;
+	int doDerive = 0;
+	int doRandom = 0;
+	int doWrap = 0;
+	int doUnwrap = 0;
 	int action = 0;
 	int rv = 0;
 
-	moduleHandle = NULL;
 	p11 = NULL;
 
 	while ((opt = getopt_long(argc, argv, "hv", long_options, &option_index)) != -1)
@@ -148,6 +427,55 @@ int main(int argc, char* argv[])
 				doSign = 1;
 				action++;
 				break;
+			case OPT_VERIFY:
+				doVerify = 1;
+				action++;
+				break;
+			case OPT_ENCRYPT:
+				doEncrypt = 1;
+				action++;
+				break;
+			case OPT_DECRYPT:
+				doDecrypt = 1;
+				action++;
+				break;
+			case OPT_DIGEST:
+				doDigest = 1;
+				action++;
+				break;
+			case OPT_HMAC:
+				doHmac = 1;
+				action++;
+				break;
+			case OPT_KEYGEN:
+				doKeygen = 1;
+				action++;
+				break;
+			case OPT_DERIVE:
+				doDerive = 1;
+				action++;
+				break;
+			case OPT_RANDOM:
+				doRandom = 1;
+				action++;
+				break;
+			case OPT_WRAP:
+				doWrap = 1;
+				action++;
+				break;
+			case OPT_UNWRAP:
+				doUnwrap = 1;
+				action++;
+				break;
+			case OPT_CHUNK_SIZE:
+				chunksize = optarg;
+				break;
+			case OPT_DATA_SIZE:
+				datasize = optarg;
+				break;
+			case OPT_DURATION:
+				duration = optarg;
+				break;
 			case OPT_ITERATIONS:
 				iterations = optarg;
 				break;
@@ -158,17 +486,82 @@ int main(int argc, char* argv[])
 				mechanism = optarg;
 				break;
 			case OPT_MODULE:
-				module = optarg;
+				if (moduleCount == MODULES_MAX)
+				{
+					log_error("At most %i modules can be used\n",
+						  MODULES_MAX);
+					return 1;
+				}
+				moduleList[moduleCount].path = optarg;
+				moduleList[moduleCount].handle = NULL;
+				moduleList[moduleCount].p11 = NULL;
+				moduleList[moduleCount].slotCount = 0;
+				moduleCount++;
+				break;
+			case OPT_OAEP_HASH:
+				oaephash = optarg;
+				break;
+			case OPT_OAEP_MGF:
+				oaepmgf = optarg;
 				break;
 			case OPT_PIN:
 				userPIN = optarg;
 				break;
+			case OPT_PROCESSES:
+				processes = optarg;
+				break;
+			case OPT_RATE:
+				rate = optarg;
+				break;
+			case OPT_CPU_LIST:
+				cpulist = optarg;
+				break;
+			case OPT_CPU_SPREAD:
+				cpuspread = optarg;
+				break;
+			case OPT_SCHED_FIFO:
+				schedfifo = optarg;
+				break;
+			case OPT_NICE:
+				nicelevel = optarg;
+				break;
+			case OPT_SESSIONS:
+				sessions = optarg;
+				break;
+			case OPT_KEYS:
+				keys = optarg;
+				break;
+			case OPT_KEY_DISTRIBUTION:
+				distribution = optarg;
+				break;
 			case OPT_SLOT:
-				slot = optarg;
+				if (slotArgCount == MODULES_MAX)
+				{
+					log_error("At most %i slot lists can be used\n",
+						  MODULES_MAX);
+					return 1;
+				}
+				if (slot == NULL) slot = optarg;
+				slotArgs[slotArgCount++] = optarg;
+				break;
+			case OPT_SWEEP_THREADS:
+				sweep = optarg;
+				break;
+			case OPT_STACK_SIZE:
+				stacksize = optarg;
+				break;
+			case OPT_COMPARE:
+				compare = optarg;
+				break;
+			case OPT_TARGET_P99:
+				target = optarg;
 				break;
 			case OPT_THREADS:
 				threads = optarg;
 				break;
+			case OPT_WARMUP:
+				warmup = optarg;
+				break;
 			case OPT_VERSION:
 			case 'v':
 				printf("%s\n", PACKAGE_VERSION);
@@ -190,23 +583,31 @@ int main(int argc, char* argv[])
 	}
 	else
 	{
-		// Get a pointer to the function list for PKCS#11 library
-		CK_C_GetFunctionList pGetFunctionList = loadLibrary(module, &moduleHandle, &errMsg);
-		if (!pGetFunctionList)
+		// Without --module, the default library is used
+		if (moduleCount == 0)
 		{
-			log_fatal("Could not load the library: %s\n", errMsg);
-			exit(1);
+			moduleList[0].path = NULL;
+			moduleList[0].handle = NULL;
+			moduleList[0].p11 = NULL;
+			moduleList[0].slotCount = 0;
+			moduleCount = 1;
 		}
 
-		// Load the function list
-		(*pGetFunctionList)(&p11);
-
-		// Initialize the library
-		CK_C_INITIALIZE_ARGS initArgs = { NULL, NULL, NULL, NULL, CKF_OS_LOCKING_OK, NULL };
-		CK_RV p11rv = p11->C_Initialize((CK_VOID_PTR) &initArgs);
-		if (p11rv != CKR_OK)
+		// A module may not survive a fork after C_Initialize(), so the
+		// worker processes load the modules on their own
+		if (processes != NULL)
+		{
+			if (doShowSlots || doEncrypt || doDecrypt || doDigest ||
+			    doHmac || doKeygen || doDerive || doWrap || doUnwrap ||
+			    doRandom)
+			{
+				log_error("The worker processes can only be used with "
+					  "--sign and --verify\n");
+				return 1;
+			}
+		}
+		else if (loadModules(moduleList, moduleCount))
 		{
-			log_fatal("Could not initialize the library.\n");
 			exit(1);
 		}
 	}
@@ -214,11 +615,21 @@ int main(int argc, char* argv[])
 	// Show all available slots
 	if (doShowSlots)
 	{
-		rv = showSlots();
+		for (m=0; m<moduleCount; m++)
+		{
+			if (moduleCount > 1)
+			{
+				printf("Module %s:\n", getModuleName(&moduleList[m]));
+			}
+			p11 = moduleList[m].p11;
+			rv = showSlots();
+		}
+		p11 = moduleList[0].p11;
 	}
 
-	// Sign operation
-	if (doSign)
+	// Benchmark operations
+	if (doSign || doVerify || doEncrypt || doDecrypt || doDigest || doHmac ||
+	    doKeygen || doDerive || doWrap || doUnwrap || doRandom)
 	{
 		if (slot == NULL)
 		{
@@ -226,114 +637,688 @@ int main(int argc, char* argv[])
 				  "Use --slot <number>\n");
 			return 1;
 		}
-		if (threads == NULL)
+		if (threads == NULL && sweep == NULL)
 		{
 			log_error("The number of threads must be supplied. "
 				  "Use --threads <number>\n");
 			return 1;
 		}
-		if (iterations == NULL)
+		// The other benchmarks keep a full histogram per thread, the sign
+		// and verify threads share them above HISTOGRAM_STRIPES threads
+		if (threads != NULL &&
+		    (atoi(threads) < 1 ||
+		     atoi(threads) > ((doEncrypt || doDecrypt || doDigest || doHmac ||
+				       doKeygen || doDerive || doWrap || doUnwrap ||
+				       doRandom) ? PTHREAD_THREADS_MAX : SIGN_THREADS_MAX)))
+		{
+			log_error("Invalid number of threads: %s [1-%i, or 1-%i for "
+				  "--sign and --verify only]\n", threads,
+				  PTHREAD_THREADS_MAX, SIGN_THREADS_MAX);
+			return 1;
+		}
+		if (stacksize != NULL && setStackSize(stacksize))
+		{
+			return 1;
+		}
+
+		if (iterations == NULL && duration == NULL)
 		{
 			log_error("The number of iterations must be supplied. "
 				  "Use --iterations <number>\n");
 			return 1;
 		}
+		if (duration != NULL && atof(duration) <= 0)
+		{
+			log_error("Invalid duration: %s\n", duration);
+			return 1;
+		}
+		if (warmup != NULL && (duration == NULL || atof(warmup) < 0))
+		{
+			log_error("The warm-up must be zero or more seconds "
+				  "and can only be used with --duration\n");
+			return 1;
+		}
+		if (rate != NULL && atof(rate) <= 0)
+		{
+			log_error("Invalid rate: %s\n", rate);
+			return 1;
+		}
+		if ((duration != NULL || rate != NULL) &&
+		    (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+		     doDerive || doWrap || doUnwrap || doRandom))
+		{
+			log_error("The duration and the rate can only be used "
+				  "with --sign and --verify\n");
+			return 1;
+		}
+		if (sweep != NULL)
+		{
+			if (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+			    doDerive || doWrap || doUnwrap || doRandom || rate != NULL)
+			{
+				log_error("The thread sweep can only be used with --sign "
+					  "and --verify, and not with --rate\n");
+				return 1;
+			}
+			if (getSweepRange(sweep, sweepMin, sweepMax)) return 1;
+		}
+		if (sessions != NULL)
+		{
+			if (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+			    doDerive || doWrap || doUnwrap || doRandom)
+			{
+				log_error("The session pool can only be used with --sign "
+					  "and --verify\n");
+				return 1;
+			}
+			if (atoi(sessions) < 1 || atoi(sessions) > SESSION_POOL_MAX)
+			{
+				log_error("Invalid number of sessions: %s [1-%i]\n",
+					  sessions, SESSION_POOL_MAX);
+				return 1;
+			}
+		}
+		if (keys != NULL || distribution != NULL)
+		{
+			if (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+			    doDerive || doWrap || doUnwrap || doRandom)
+			{
+				log_error("The key pool can only be used with --sign "
+					  "and --verify\n");
+				return 1;
+			}
+			if (keys != NULL && (atoi(keys) < 1 || atoi(keys) > KEY_POOL_MAX))
+			{
+				log_error("Invalid number of keys: %s [1-%i]\n",
+					  keys, KEY_POOL_MAX);
+				return 1;
+			}
+		}
+		if (slotArgCount != 1 && slotArgCount != moduleCount)
+		{
+			log_error("Give one --slot for all modules, "
+				  "or one --slot per --module\n");
+			return 1;
+		}
+		for (m=0; m<moduleCount; m++)
+		{
+			if (getSlotList(slotArgs[slotArgCount > 1 ? m : 0],
+					moduleList[m].slotList, moduleList[m].slotCount))
+			{
+				return 1;
+			}
+		}
+		if ((moduleCount > 1 || moduleList[0].slotCount > 1) &&
+		    (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+		     doDerive || doWrap || doUnwrap || doRandom))
+		{
+			log_error("A list of slots and more than one module can only "
+				  "be used with --sign and --verify\n");
+			return 1;
+		}
+		if (moduleCount > 1 &&
+		    (sweep ? sweepMax : (unsigned int)atoi(threads)) * moduleCount >
+		    SIGN_THREADS_MAX)
+		{
+			log_error("Each module gets its own threads, and at most "
+				  "%i threads can be used in total\n",
+				  SIGN_THREADS_MAX);
+			return 1;
+		}
+		if (processes != NULL)
+		{
+			if (sweep != NULL || compare != NULL || rate != NULL)
+			{
+				log_error("The worker processes cannot be used with "
+					  "--sweep-threads, --compare or --rate\n");
+				return 1;
+			}
+			if (atoi(processes) < 1 || atoi(processes) > PROCESSES_MAX)
+			{
+				log_error("Invalid number of processes: %s [1-%i]\n",
+					  processes, PROCESSES_MAX);
+				return 1;
+			}
+		}
+		if (compare != NULL)
+		{
+			if (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+			    doDerive || doWrap || doUnwrap || doRandom || sweep != NULL)
+			{
+				log_error("The comparison can only be used with --sign "
+					  "and --verify, and not with --sweep-threads\n");
+				return 1;
+			}
+			if (atoi(compare) < 2 || atoi(compare) > COMPARE_TRIALS_MAX)
+			{
+				log_error("Invalid number of trials: %s [2-%i]\n",
+					  compare, COMPARE_TRIALS_MAX);
+				return 1;
+			}
+			if (moduleList[0].slotCount + (moduleCount > 1 ? moduleList[1].slotCount : 0) != 2 ||
+			    moduleCount > 2)
+			{
+				log_error("The comparison needs two modules with one slot "
+					  "each, or one module with two slots\n");
+				return 1;
+			}
+		}
+		if (target != NULL)
+		{
+			if (doEncrypt || doDecrypt || doDigest || doHmac || doKeygen ||
+			    doDerive || doWrap || doUnwrap || doRandom || sweep != NULL ||
+			    compare != NULL || processes != NULL || rate != NULL ||
+			    sessions != NULL)
+			{
+				log_error("The p99 target can only be used with --sign and "
+					  "--verify, and not with --sweep-threads, --compare, "
+					  "--processes, --rate or --sessions\n");
+				return 1;
+			}
+			if (atof(target) <= 0)
+			{
+				log_error("Invalid p99 target: %s\n", target);
+				return 1;
+			}
+		}
+		// Only the RSA decryption is benchmarked, from a pool of
+		// ciphertexts that is made up front
+		if (doEncrypt && mechanism != NULL &&
+		    strncmp(mechanism, "RSA_", 4) == 0)
+		{
+			log_error("The RSA mechanisms cannot be used with --encrypt, "
+				  "use --decrypt alone for the RSA decryption "
+				  "benchmark\n");
+			return 1;
+		}
+		if (setPlacement(cpulist, cpuspread, schedfifo, nicelevel))
+		{
+			return 1;
+		}
+		printPlacement();
+	}
+
+	// Sign and verify operations
+	if (doSign || doVerify)
+	{
+		// With worker processes, the parent only reports their results
+		if (processes != NULL)
+		{
+			rv = startProcesses(atoi(processes), moduleList, moduleCount, userPIN);
+		}
+		if (processes == NULL || signProcess.share != NULL)
+		{
+			rv = testSign(moduleList, moduleCount, userPIN, mechanism, keysize,
+			      datasize, chunksize,
+			      (sweep ? sweepMax : atoi(threads)), sweepMin,
+			      (compare ? atoi(compare) : 0),
+			      (target ? atof(target) / 1000 : 0),
+			      (sessions ? atoi(sessions) : 0),
+			      (keys ? atoi(keys) : 1), distribution,
+			      (iterations ? atoi(iterations) : 0),
+			      (duration ? atof(duration) : 0),
+			      (warmup ? atof(warmup) : 0),
+			      (rate ? atof(rate) : 0),
+			      doSign, doVerify);
+		}
+		if (signProcess.share != NULL)
+		{
+			unloadModules(moduleList, moduleCount);
+			exit(rv);
+		}
+	}
+
+	// RSA decryption has its own benchmark
+	if (doDecrypt && mechanism != NULL &&
+	    strncmp(mechanism, "RSA_", 4) == 0)
+	{
+		rv = testRsaDecrypt(atoi(slot), userPIN, mechanism, keysize,
+				    oaephash, oaepmgf, atoi(threads),
+				    atoi(iterations));
+	}
+	// Encrypt and decrypt operations
+	else if (doEncrypt || doDecrypt)
+	{
+		rv = testCipher(atoi(slot), userPIN, mechanism, keysize,
+				datasize, chunksize, atoi(threads), atoi(iterations),
+				doEncrypt, doDecrypt);
+	}
+
+	// Digest operation
+	if (doDigest)
+	{
+		rv = testHash(atoi(slot), userPIN, mechanism, keysize,
+			      datasize, chunksize, atoi(threads), atoi(iterations),
+			      BulkOp::Digest);
+	}
 
-		rv = testSign(atoi(slot), userPIN, mechanism, keysize,
-			      atoi(threads), atoi(iterations));
+	// HMAC operation
+	if (doHmac)
+	{
+		rv = testHash(atoi(slot), userPIN, mechanism, keysize,
+			      datasize, chunksize, atoi(threads), atoi(iterations),
+			      BulkOp::Mac);
+	}
+
+	// Key generation
+	if (doKeygen)
+	{
+		rv = testKeygen(atoi(slot), userPIN, mechanism, keysize,
+				atoi(threads), atoi(iterations));
+	}
+
+	// Key derivation
+	if (doDerive)
+	{
+		rv = testDerive(atoi(slot), userPIN, mechanism, keysize,
+				atoi(threads), atoi(iterations));
+	}
+
+	// Random number generation
+	if (doRandom)
+	{
+		rv = testRandom(atoi(slot), datasize, atoi(threads),
+				atoi(iterations));
+	}
+
+	// Wrap and unwrap operations
+	if (doWrap || doUnwrap)
+	{
+		rv = testWrap(atoi(slot), userPIN, mechanism, keysize,
+			      oaephash, oaepmgf, atoi(threads), atoi(iterations),
+			      doWrap, doUnwrap);
 	}
 
 	// Finalize the library
 	if (action)
 	{
-		p11->C_Finalize(NULL_PTR);
-		unloadLibrary(moduleHandle);
+		unloadModules(moduleList, moduleCount);
 	}
 
 	return rv;
 }
 
-// Show what slots are available
-int showSlots()
+// Load and initialize the modules
+int loadModules(module_t* moduleList, unsigned int moduleCount)
 {
-	CK_ULONG ulSlotCount;
-	CK_RV rv = p11->C_GetSlotList(CK_FALSE, NULL_PTR, &ulSlotCount);
-	if (rv != CKR_OK)
+	char* errMsg = NULL;
+	unsigned int m;
+
+	for (m=0; m<moduleCount; m++)
 	{
-		log_error("Could not get the number of slots.\n");
-		return 1;
+		// Get a pointer to the function list for PKCS#11 library
+		CK_C_GetFunctionList pGetFunctionList = loadLibrary(moduleList[m].path, &moduleList[m].handle, &errMsg);
+		if (!pGetFunctionList)
+		{
+			log_fatal("Could not load the library: %s\n", errMsg);
+			return 1;
+		}
+
+		// Load the function list
+		(*pGetFunctionList)(&moduleList[m].p11);
+
+		// Initialize the library
+		CK_C_INITIALIZE_ARGS initArgs = { NULL, NULL, NULL, NULL, CKF_OS_LOCKING_OK, NULL };
+		CK_RV p11rv = moduleList[m].p11->C_Initialize((CK_VOID_PTR) &initArgs);
+		if (p11rv != CKR_OK)
+		{
+			log_fatal("Could not initialize the library.\n");
+			return 1;
+		}
 	}
 
-	CK_SLOT_ID_PTR pSlotList = (CK_SLOT_ID_PTR) malloc(ulSlotCount*sizeof(CK_SLOT_ID));
-	if (!pSlotList)
+	// Everything but the sign and verify threads uses the first module
+	p11 = moduleList[0].p11;
+
+	return 0;
+}
+
+// Finalize the modules that were loaded
+void unloadModules(module_t* moduleList, unsigned int moduleCount)
+{
+	unsigned int m;
+
+	for (m=0; m<moduleCount; m++)
 	{
-		log_error("Could not allocate memory.\n");
-		return 1;
+		if (moduleList[m].p11 == NULL) continue;
+
+		moduleList[m].p11->C_Finalize(NULL_PTR);
+		unloadLibrary(moduleList[m].handle);
+		moduleList[m].p11 = NULL;
 	}
+}
 
-	rv = p11->C_GetSlotList(CK_FALSE, pSlotList, &ulSlotCount);
-	if (rv != CKR_OK)
+// Fork the worker processes. A worker process returns with the modules
+// loaded and runs the benchmark. The parent waits for the workers and
+// reports their combined result.
+int startProcesses(unsigned int processes, module_t* moduleList, unsigned int moduleCount, char* &userPIN)
+{
+	static char user_pin_copy[MAX_PIN_LEN+1];
+	process_share_t* share;
+	pthread_mutexattr_t mutexAttr;
+	pthread_condattr_t condAttr;
+	size_t size;
+	pid_t pid;
+	unsigned int n;
+	int status, result = 0;
+
+	// The PIN is asked once, before the workers are started
+	getPW(userPIN, user_pin_copy, CKU_USER);
+	userPIN = user_pin_copy;
+
+	size = sizeof(process_share_t) + sizeof(process_phase_t) * 2 * processes;
+	share = (process_share_t*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (share == MAP_FAILED)
 	{
-		log_error("Could not get the slot list.\n");
-		free(pSlotList);
+		log_error("Could not map the shared memory: %s\n", strerror(errno));
 		return 1;
 	}
+	memset(share, 0, size);
+	share->processes = processes;
+	share->results = (process_phase_t*)(share + 1);
 
-	printf("Available slots:\n");
+	pthread_mutexattr_init(&mutexAttr);
+	pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&share->mutex, &mutexAttr);
+	pthread_mutexattr_destroy(&mutexAttr);
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&share->cond, &condAttr);
+	pthread_condattr_destroy(&condAttr);
 
-	for (CK_ULONG i = 0; i < ulSlotCount; i++)
+	// Anything still buffered would be written by every worker
+	fflush(stdout);
+	fflush(stderr);
+
+	for (n=0; n<processes; n++)
 	{
-		CK_SLOT_INFO slotInfo;
-		CK_TOKEN_INFO tokenInfo;
+		pid = fork();
+		if (pid == 0)
+		{
+			signProcess.share = share;
+			signProcess.index = n;
+			signProcess.phase = 0;
 
-		rv = p11->C_GetSlotInfo(pSlotList[i], &slotInfo);
-		if (rv != CKR_OK)
+			// Only the parent prints the results
+			if (freopen("/dev/null", "w", stdout) == NULL)
+			{
+				log_error("Could not redirect the output of process %u.\n", n);
+			}
+			if (loadModules(moduleList, moduleCount))
+			{
+				exit(1);
+			}
+			return 0;
+		}
+		if (pid < 0)
 		{
-			log_error("Could not get info about slot %lu.\n", pSlotList[i]);
-			continue;
+			log_error("Could not start a process: %s\n", strerror(errno));
+			failProcesses(share);
+			result = 1;
+			break;
 		}
+	}
 
-		printf("Slot %lu\n", pSlotList[i]);
-		printf("    Slot info:\n");
-		printf("        Description:      %.*s\n", 64, slotInfo.slotDescription);
-		printf("        Manufacturer ID:  %.*s\n", 32, slotInfo.manufacturerID);
-		printf("        Hardware version: %i.%i\n", slotInfo.hardwareVersion.major,
-							    slotInfo.hardwareVersion.minor);
-		printf("        Firmware version: %i.%i\n", slotInfo.firmwareVersion.major,
-							    slotInfo.firmwareVersion.minor);
-		printf("        Token present:    ");
-		if ((slotInfo.flags & CKF_TOKEN_PRESENT) == 0)
+	log_notice("Started %u worker processes...\n", n);
+
+	// Wait for all workers, a failed worker stops the others at the start
+	// of the next phase
+	while ((pid = wait(&status)) > 0 || errno == EINTR)
+	{
+		if (pid > 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
 		{
-			printf("no\n");
-			continue;
+			failProcesses(share);
+			result = 1;
 		}
+	}
 
-		printf("yes\n");
-		printf("    Token info:\n");
+	printProcesses(share);
 
-		rv = p11->C_GetTokenInfo(pSlotList[i], &tokenInfo);
-		if (rv != CKR_OK)
+	pthread_cond_destroy(&share->cond);
+	pthread_mutex_destroy(&share->mutex);
+	munmap(share, size);
+
+	return result;
+}
+
+// Report the result of each worker process and the combined result. The
+// processes measure over spans of their own, which need not line up. The
+// combined throughput divides the operations of all processes by the union of
+// their spans, so it does not count more concurrency than there was.
+void printProcesses(process_share_t* share)
+{
+	process_phase_t* result;
+	histogram_t histogram;
+	unsigned long counted, windowCounted;
+	double throughput, firstStart, lastStart, firstStop, lastStop;
+	unsigned int phase, n, threads;
+
+	for (phase=0; phase<2; phase++)
+	{
+		counted = 0;
+		windowCounted = 0;
+		threads = 0;
+		firstStart = lastStart = firstStop = lastStop = 0;
+		histogramReset(&histogram);
+
+		for (n=0; n<share->processes; n++)
 		{
-			log_error("Could not get info about the token in slot %lu.\n",
-				  pSlotList[i]);
-			continue;
+			result = &share->results[2 * n + phase];
+			if (!result->done) continue;
+
+			printf("Process %u: %lu %s, %.2f %s\n", n + 1, result->counted,
+			       share->operation[phase], result->throughput,
+			       share->unit[phase]);
+			if (threads == 0 || result->windowStart < firstStart) firstStart = result->windowStart;
+			if (threads == 0 || result->windowStart > lastStart) lastStart = result->windowStart;
+			if (threads == 0 || result->windowStop < firstStop) firstStop = result->windowStop;
+			if (threads == 0 || result->windowStop > lastStop) lastStop = result->windowStop;
+			counted += result->counted;
+			windowCounted += result->windowCounted;
+			threads = result->threads;
+			histogramMerge(&histogram, &result->histogram);
 		}
+		if (threads == 0 || lastStop <= firstStart) continue;
+		throughput = windowCounted / (lastStop - firstStart);
 
-		printf("        Manufacturer ID:  %.*s\n", 32, tokenInfo.manufacturerID);
-		printf("        Model:            %.*s\n", 16, tokenInfo.model);
-		printf("        Hardware version: %i.%i\n", tokenInfo.hardwareVersion.major,
-							    tokenInfo.hardwareVersion.minor);
-		printf("        Firmware version: %i.%i\n", tokenInfo.firmwareVersion.major,
-							    tokenInfo.firmwareVersion.minor);
-		printf("        Serial number:    %.*s\n", 16, tokenInfo.serialNumber);
-		printf("        Initialized:      ");
-		if ((tokenInfo.flags & CKF_TOKEN_INITIALIZED) == 0)
+		printf("%u processes of %u %s, %lu %s, %.2f %s (%s)\n",
+		       share->processes, threads, (threads > 1 ? "threads" : "thread"),
+		       counted, share->operation[phase], throughput,
+		       share->unit[phase], share->description[phase]);
+		if (firstStop > lastStart)
 		{
-			printf("no\n");
+			printf("The processes ran together for %.2f of %.2f seconds\n",
+			       firstStop - lastStart, lastStop - firstStart);
 		}
 		else
 		{
-			printf("yes\n");
+			log_error("The processes did not run at the same time, the "
+				  "combined throughput is no concurrent capacity\n");
+		}
+		histogramPrint(share->label[phase], &histogram);
+	}
+}
+
+// Wait until all worker processes are ready to start the phase. The wait
+// is bounded, so that a worker that died without a word is noticed when
+// the parent has reaped it.
+// Returns non-zero when a worker has failed.
+int waitForProcesses()
+{
+	process_share_t* share = signProcess.share;
+	struct timespec deadline;
+	int failed;
+
+	if (share == NULL) return 0;
+
+	pthread_mutex_lock(&share->mutex);
+	if (++share->arrived[signProcess.phase] == (int)share->processes)
+	{
+		pthread_cond_broadcast(&share->cond);
+	}
+	while (share->arrived[signProcess.phase] < (int)share->processes &&
+	       !share->failed)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += PROCESS_WAIT_NS;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&share->cond, &share->mutex, &deadline);
+	}
+	failed = (share->arrived[signProcess.phase] < (int)share->processes);
+	pthread_mutex_unlock(&share->mutex);
+
+	return failed;
+}
+
+// Stop the worker processes that wait for the next phase
+void failProcesses(process_share_t* share)
+{
+	pthread_mutex_lock(&share->mutex);
+	share->failed = 1;
+	pthread_cond_broadcast(&share->cond);
+	pthread_mutex_unlock(&share->mutex);
+}
+
+// Give the result of the phase to the parent
+void storeProcessResult
+(
+	unsigned int threads,
+	unsigned long counted,
+	double throughput,
+	thread_times_t* window,
+	histogram_t* histogram,
+	const char* label,
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details
+)
+{
+	process_share_t* share = signProcess.share;
+	process_phase_t* result;
+	unsigned int phase = signProcess.phase;
+	size_t len;
+
+	if (share == NULL || phase > 1) return;
+
+	snprintf(share->label[phase], sizeof(share->label[phase]), "%s", label);
+	snprintf(share->operation[phase], sizeof(share->operation[phase]), "%s", operation);
+	snprintf(share->unit[phase], sizeof(share->unit[phase]), "%s", unit);
+	snprintf(share->description[phase], sizeof(share->description[phase]), "%s", mechanism);
+	len = strlen(share->description[phase]);
+	if (bits)
+	{
+		snprintf(share->description[phase] + len,
+			 sizeof(share->description[phase]) - len, " %u bits", bits);
+		len = strlen(share->description[phase]);
+	}
+	if (details)
+	{
+		snprintf(share->description[phase] + len,
+			 sizeof(share->description[phase]) - len, ", %s", details);
+	}
+
+	result = &share->results[2 * signProcess.index + phase];
+	result->threads = threads;
+	result->counted = counted;
+	result->throughput = throughput;
+	result->windowStart = window->windowStart;
+	result->windowStop = window->windowStop;
+	result->windowCounted = window->counted;
+	result->histogram = *histogram;
+	result->done = 1;
+
+	signProcess.phase++;
+}
+
+// Show what slots are available
+int showSlots()
+{
+	CK_ULONG ulSlotCount;
+	CK_RV rv = p11->C_GetSlotList(CK_FALSE, NULL_PTR, &ulSlotCount);
+	if (rv != CKR_OK)
+	{
+		log_error("Could not get the number of slots.\n");
+		return 1;
+	}
+
+	CK_SLOT_ID_PTR pSlotList = (CK_SLOT_ID_PTR) malloc(ulSlotCount*sizeof(CK_SLOT_ID));
+	if (!pSlotList)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+
+	rv = p11->C_GetSlotList(CK_FALSE, pSlotList, &ulSlotCount);
+	if (rv != CKR_OK)
+	{
+		log_error("Could not get the slot list.\n");
+		free(pSlotList);
+		return 1;
+	}
+
+	printf("Available slots:\n");
+
+	for (CK_ULONG i = 0; i < ulSlotCount; i++)
+	{
+		CK_SLOT_INFO slotInfo;
+		CK_TOKEN_INFO tokenInfo;
+
+		rv = p11->C_GetSlotInfo(pSlotList[i], &slotInfo);
+		if (rv != CKR_OK)
+		{
+			log_error("Could not get info about slot %lu.\n", pSlotList[i]);
+			continue;
+		}
+
+		printf("Slot %lu\n", pSlotList[i]);
+		printf("    Slot info:\n");
+		printf("        Description:      %.*s\n", 64, slotInfo.slotDescription);
+		printf("        Manufacturer ID:  %.*s\n", 32, slotInfo.manufacturerID);
+		printf("        Hardware version: %i.%i\n", slotInfo.hardwareVersion.major,
+							    slotInfo.hardwareVersion.minor);
+		printf("        Firmware version: %i.%i\n", slotInfo.firmwareVersion.major,
+							    slotInfo.firmwareVersion.minor);
+		printf("        Token present:    ");
+		if ((slotInfo.flags & CKF_TOKEN_PRESENT) == 0)
+		{
+			printf("no\n");
+			continue;
+		}
+
+		printf("yes\n");
+		printf("    Token info:\n");
+
+		rv = p11->C_GetTokenInfo(pSlotList[i], &tokenInfo);
+		if (rv != CKR_OK)
+		{
+			log_error("Could not get info about the token in slot %lu.\n",
+				  pSlotList[i]);
+			continue;
+		}
+
+		printf("        Manufacturer ID:  %.*s\n", 32, tokenInfo.manufacturerID);
+		printf("        Model:            %.*s\n", 16, tokenInfo.model);
+		printf("        Hardware version: %i.%i\n", tokenInfo.hardwareVersion.major,
+							    tokenInfo.hardwareVersion.minor);
+		printf("        Firmware version: %i.%i\n", tokenInfo.firmwareVersion.major,
+							    tokenInfo.firmwareVersion.minor);
+		printf("        Serial number:    %.*s\n", 16, tokenInfo.serialNumber);
+		printf("        Initialized:      ");
+		if ((tokenInfo.flags & CKF_TOKEN_INITIALIZED) == 0)
+		{
+			printf("no\n");
+		}
+		else
+		{
+			printf("yes\n");
 		}
 
 		printf("        User PIN init.:   ");
@@ -355,45 +1340,14 @@ int showSlots()
 	return 0;
 }
 
-// Benchmark signing operations
-int testSign
-(
-	unsigned int slot,
-	char* userPIN,
-	char* mechanism,
-	char* keysize,
-	unsigned int threads,
-	unsigned int iterations
-)
+// Open a read-write session and login the user
+int openSession(unsigned int slot, char* userPIN, CK_SESSION_HANDLE &hSession)
 {
-	CK_RV rv;
-	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
-	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
-	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
-	CK_OBJECT_HANDLE hPublicKey = CK_INVALID_HANDLE;
-	CK_OBJECT_HANDLE hPrivateKey = CK_INVALID_HANDLE;
-
 	char user_pin_copy[MAX_PIN_LEN+1];
-	sign_arg_t sign_arg_array[PTHREAD_THREADS_MAX];
-	pthread_t thread_array[PTHREAD_THREADS_MAX];
-	pthread_attr_t thread_attr;
-	void* thread_status;
-	unsigned int n, bits = 0;
-	static struct timeval start,end;
-	double elapsed, speed;
-	int result = 1;
-	HashAlgo::Type hashType = HashAlgo::Unknown;
-
-	if (mechanism == NULL)
-	{
-		log_error("A mechanism must be supplied. "
-			  "Use --mechanism <mech>\n");
-		return 1;
-	}
 
 	// Open read-write session
-	rv = p11->C_OpenSession((CK_SLOT_ID)slot, CKF_SERIAL_SESSION | CKF_RW_SESSION,
-				NULL_PTR, NULL_PTR, &hSessionRW);
+	CK_RV rv = p11->C_OpenSession((CK_SLOT_ID)slot, CKF_SERIAL_SESSION | CKF_RW_SESSION,
+				      NULL_PTR, NULL_PTR, &hSession);
 	if (rv != CKR_OK)
 	{
 		if (rv == CKR_SLOT_ID_INVALID)
@@ -417,7 +1371,7 @@ int testSign
 	getPW(userPIN, user_pin_copy, CKU_USER);
 
 	// Login USER into the sessions so we can create private objects
-	rv = p11->C_Login(hSessionRW, CKU_USER, (CK_UTF8CHAR_PTR)user_pin_copy,
+	rv = p11->C_Login(hSession, CKU_USER, (CK_UTF8CHAR_PTR)user_pin_copy,
 			  strlen(user_pin_copy));
 	if (rv != CKR_OK)
 	{
@@ -434,535 +1388,5170 @@ int testSign
 		return 1;
 	}
 
-	log_notice("Key generation started...\n");
-	gettimeofday(&start, NULL);
+	return 0;
+}
 
-	// Generate key
-	if (strcmp(mechanism, "RSA_PKCS") == 0)
-	{
-		if (keysize == NULL)
-		{
-			log_error("A key size must be supplied. "
-				  "Use --keysize <bits>\n");
-			return 1;
-		}
+// Translate the mechanism name and key size given on the command line
+int getSignMechanism
+(
+	char* mechanism,
+	char* keysize,
+	CK_MECHANISM_TYPE &mechanismType,
+	CK_KEY_TYPE &keyType,
+	HashAlgo::Type &hashType,
+	unsigned int &bits
+)
+{
+	size_t i;
 
-		bits = atoi(keysize);
-		if (bits < 1024 || bits > 4096)
-		{
-			log_error("Invalid key size: "
-				  "%i [1024-4096]\n", bits);
-			return 1;
-		}
+	bits = 0;
 
-		mechanismType = CKM_RSA_PKCS;
-		hashType = HashAlgo::SHA256;
-		result = generateRsa(hSessionRW, bits, hPublicKey, hPrivateKey);
+	if (mechanism == NULL)
+	{
+		log_error("A mechanism must be supplied. "
+			  "Use --mechanism <mech>\n");
+		return 1;
 	}
-	else if (strcmp(mechanism, "DSA") == 0)
+
+	for (i=0; i<sizeof(sign_mechanisms)/sizeof(sign_mechanisms[0]); i++)
 	{
-		if (keysize == NULL)
-		{
-			log_error("A key size must be supplied. "
-				  "Use --keysize <bits>\n");
-			return 1;
-		}
+		if (strcmp(mechanism, sign_mechanisms[i].name) == 0) break;
+	}
+	if (i == sizeof(sign_mechanisms)/sizeof(sign_mechanisms[0]))
+	{
+		log_error("Unknown signing mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
 
-		bits = atoi(keysize);
-		if (bits < 1024 || bits > 4096)
-		{
-			log_error("Invalid key size: "
-				  "%i [1024-4096]\n", bits);
-			return 1;
-		}
+	mechanismType = sign_mechanisms[i].mechanismType;
+	keyType = sign_mechanisms[i].keyType;
+	hashType = sign_mechanisms[i].hashType;
 
-		mechanismType = CKM_DSA;
-		hashType = HashAlgo::SHA256;
-		result = generateDsa(hSessionRW, bits, hPublicKey, hPrivateKey);
+	// GOST has a fixed key size
+	if (keyType == CKK_GOSTR3410)
+	{
+		return 0;
+	}
+
+	if (keysize == NULL)
+	{
+		log_error("A key size must be supplied. "
+			  "Use --keysize <bits>\n");
+		return 1;
 	}
-	else if (strcmp(mechanism, "ECDSA") == 0)
+
+	bits = atoi(keysize);
+	if (keyType == CKK_EC)
 	{
-		if (keysize == NULL)
+		if (bits != 256 && bits != 384)
 		{
-			log_error("A key size must be supplied. "
-				  "Use --keysize <bits>\n");
+			log_error("Invalid key size: "
+				  "%i [256, 384]\n", bits);
 			return 1;
 		}
 
-		bits = atoi(keysize);
-		if (bits == 256)
+		// Raw ECDSA signs a hash that matches the curve
+		if (hashType != HashAlgo::None)
 		{
-			hashType = HashAlgo::SHA256;
+			hashType = (bits == 256 ? HashAlgo::SHA256 : HashAlgo::SHA384);
 		}
-		else if (bits == 384)
-		{
-			hashType = HashAlgo::SHA384;
-		}
-		else
+	}
+	else if (keyType == CKK_EC_EDWARDS)
+	{
+		if (bits != 255 && bits != 448)
 		{
 			log_error("Invalid key size: "
-				  "%i [256, 384]\n", bits);
+				  "%i [255, 448]\n", bits);
 			return 1;
 		}
+	}
+	else if (bits < 1024 || bits > 4096)
+	{
+		log_error("Invalid key size: "
+			  "%i [1024-4096]\n", bits);
+		return 1;
+	}
 
-		mechanismType = CKM_ECDSA;
-		result = generateEcdsa(hSessionRW, bits, hPublicKey, hPrivateKey);
+	return 0;
+}
 
-	}
-	else if (strcmp(mechanism, "GOSTR3410") == 0)
+// Get the PSS parameters that match the hash of the mechanism
+void getPssParams(CK_MECHANISM_TYPE mechanismType, CK_RSA_PKCS_PSS_PARAMS &params)
+{
+	switch (mechanismType)
 	{
-		mechanismType = CKM_GOSTR3410;
-		hashType = HashAlgo::GOST;
-		result = generateGost(hSessionRW, hPublicKey, hPrivateKey);
+		case CKM_SHA1_RSA_PKCS_PSS:
+			params.hashAlg = CKM_SHA_1;
+			params.mgf = CKG_MGF1_SHA1;
+			params.sLen = 20;
+			break;
+		case CKM_SHA256_RSA_PKCS_PSS:
+		default:
+			params.hashAlg = CKM_SHA256;
+			params.mgf = CKG_MGF1_SHA256;
+			params.sLen = 32;
+			break;
+		case CKM_SHA384_RSA_PKCS_PSS:
+			params.hashAlg = CKM_SHA384;
+			params.mgf = CKG_MGF1_SHA384;
+			params.sLen = 48;
+			break;
+		case CKM_SHA512_RSA_PKCS_PSS:
+			params.hashAlg = CKM_SHA512;
+			params.mgf = CKG_MGF1_SHA512;
+			params.sLen = 64;
+			break;
 	}
-	else
+}
+
+// Generate a key pair of the given key type
+int generateKeyPair
+(
+	CK_SESSION_HANDLE hSession,
+	CK_KEY_TYPE keyType,
+	unsigned int bits,
+	CK_OBJECT_HANDLE &hPuk,
+	CK_OBJECT_HANDLE &hPrk
+)
+{
+	switch (keyType)
 	{
-		log_error("Unknown signing mechanism. "
-			  "Please edit --mechanism <mech> to correct the error.\n");
-		return 1;
+		case CKK_RSA:
+			return generateRsa(hSession, bits, hPuk, hPrk, KeyUsage::Sign);
+		case CKK_DSA:
+			return generateDsa(hSession, bits, hPuk, hPrk);
+		case CKK_EC:
+			return generateEcdsa(hSession, bits, hPuk, hPrk);
+		case CKK_GOSTR3410:
+			return generateGost(hSession, hPuk, hPrk);
+		case CKK_EC_EDWARDS:
+			return generateEddsa(hSession, bits, hPuk, hPrk);
+		default:
+			log_error("generateKeyPair(): Unknown key type\n");
+			return 1;
 	}
+}
 
-	if (result != 0) return result;
+// Record when the worker has stopped. The workers end with pthread_exit(),
+// so this runs as a cleanup handler.
+void stopThread(void* arg)
+{
+	thread_start_t* thread_start = (thread_start_t*)arg;
+	start_gate_t* gate = thread_start->gate;
 
-	log_notice("Key generation done.\n");
+	thread_start->stopped = getTime();
 
-	gettimeofday(&end, NULL);
-	end.tv_sec -= start.tv_sec;
-	end.tv_usec-= start.tv_usec;
-	elapsed =(double)(end.tv_sec)+(double)(end.tv_usec)*.000001;
-	printf("Key generation took %.2f seconds.\n", elapsed);
+	// The first thread to stop closes the window
+	if (__sync_bool_compare_and_swap(&gate->windowClosed, 0, 1))
+	{
+		gate->windowStop = thread_start->stopped;
+	}
+}
 
-	/* Prepare threads */
-	pthread_attr_init(&thread_attr);
-	pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
+// Count an operation of the calling thread, and whether it completed while
+// all threads were running
+void countOperation(void)
+{
+	thread_start_t* thread_start = currentThread;
 
-	for (n=0; n<threads; n++)
-	{
-		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO);
-		if (rv != CKR_OK)
-		{
-			log_error("C_OpenSession() returned error: rv=%X\n",
-				  (unsigned int)rv);
-			return 1;
-		}
+	if (thread_start == NULL) return;
 
-		sign_arg_array[n].id = n;
-		sign_arg_array[n].iterations = iterations;
-		sign_arg_array[n].hSession = hSessionRO;
-		sign_arg_array[n].hPrivateKey = hPrivateKey;
-		sign_arg_array[n].mechanismType = mechanismType;
-		sign_arg_array[n].hashType = hashType;
+	thread_start->completed++;
+	if (thread_start->gate->windowOpen && !thread_start->gate->windowClosed)
+	{
+		thread_start->counted++;
 	}
+}
 
-	log_notice("Creating %d %s signatures using %d %s...\n",
-		   iterations * threads, mechanism,
-		   threads, (threads > 1 ? "threads" : "thread"));
-	gettimeofday(&start, NULL);
+// Wait at the start gate until all threads have been created, then run
+// the worker and record when it starts and stops
+void* startThread(void* arg)
+{
+	thread_start_t* thread_start = (thread_start_t*)arg;
+	start_gate_t* gate = thread_start->gate;
+	int aborted;
 
-	/* Create threads for signing */
+	pthread_mutex_lock(&gate->mutex);
+	gate->waiting++;
+	pthread_cond_broadcast(&gate->cond);
+	while (!gate->open)
+	{
+		pthread_cond_wait(&gate->cond, &gate->mutex);
+	}
+	aborted = gate->aborted;
+	pthread_mutex_unlock(&gate->mutex);
+
+	if (aborted) return NULL;
+
+	currentThread = thread_start;
+	thread_start->started = getTime();
+
+	// The last thread to start opens the window
+	if (__sync_add_and_fetch(&gate->running, 1) == gate->threads)
+	{
+		gate->windowStart = getTime();
+		__sync_synchronize();
+		gate->windowOpen = 1;
+	}
+
+	pthread_cleanup_push(stopThread, thread_start);
+	thread_start->worker(thread_start->arg);
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+
+// Open the start gate, after waiting for the given number of threads
+void openGate(start_gate_t* gate, unsigned int threads, int aborted)
+{
+	pthread_mutex_lock(&gate->mutex);
+	while (gate->waiting < threads)
+	{
+		pthread_cond_wait(&gate->cond, &gate->mutex);
+	}
+	gate->threads = threads;
+	gate->aborted = aborted;
+	gate->open = 1;
+	pthread_cond_broadcast(&gate->cond);
+	pthread_mutex_unlock(&gate->mutex);
+}
+
+// Run the worker function in the given number of threads and measure the
+// throughput. All threads are created before any of them starts working. The
+// prepare function, if given, is called just before the threads are released.
+// With window, the throughput only counts the operations that the workers
+// completed, see countOperation(), between the start of the last thread and
+// the stop of the first thread, so that the ramp-up and the ramp-down are left
+// out. This suits the sign and verify phases, where all threads keep working
+// until the phase ends. The other benchmarks give each thread a fixed amount
+// of work, so the threads finish at different times. Their throughput counts
+// all operations from the start of the first thread to the stop of the last.
+int runThreads
+(
+	void* (*worker)(void*),
+	void* args,
+	size_t argSize,
+	unsigned int threads,
+	int window,
+	double &throughput,
+	void (*prepare)(void*, unsigned int, double),
+	thread_times_t* times
+)
+{
+	pthread_t* thread_array;
+	thread_start_t* thread_start_array;
+	start_gate_t gate;
+	pthread_attr_t thread_attr;
+	void* thread_status;
+	unsigned int n;
+	double firstStart, lastStart, firstStop, lastStop;
+	unsigned long counted = 0;
+	unsigned long completed = 0;
+	void* starts = NULL;
+	int result = 0;
+
+	thread_array = (pthread_t*) malloc(sizeof(pthread_t) * threads);
+	if (posix_memalign(&starts, CACHE_LINE_SIZE, sizeof(thread_start_t) * threads))
+	{
+		starts = NULL;
+	}
+	thread_start_array = (thread_start_t*) starts;
+	if (thread_array == NULL || thread_start_array == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		free(thread_array);
+		free(thread_start_array);
+		return 1;
+	}
+
+	/* Prepare threads */
+	pthread_attr_init(&thread_attr);
+	pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
+	if (threadStackSize &&
+	    pthread_attr_setstacksize(&thread_attr, threadStackSize) != 0)
+	{
+		log_error("Could not set the stack size of the threads to %lu "
+			  "bytes.\n", (unsigned long) threadStackSize);
+		pthread_attr_destroy(&thread_attr);
+		free(thread_array);
+		free(thread_start_array);
+		return 1;
+	}
+
+	pthread_mutex_init(&gate.mutex, NULL);
+	pthread_cond_init(&gate.cond, NULL);
+	gate.waiting = 0;
+	gate.threads = 0;
+	gate.open = 0;
+	gate.aborted = 0;
+	gate.running = 0;
+	gate.windowOpen = 0;
+	gate.windowClosed = 0;
+	gate.windowStart = 0;
+	gate.windowStop = 0;
+
+	/* Create threads */
 	for (n=0; n<threads; n++)
 	{
+		thread_start_array[n].worker = worker;
+		thread_start_array[n].arg = (char*)args + n * argSize;
+		thread_start_array[n].gate = &gate;
+		thread_start_array[n].started = 0;
+		thread_start_array[n].stopped = 0;
+		thread_start_array[n].counted = 0;
+		thread_start_array[n].completed = 0;
+
+		if (placeThread(&thread_attr, n))
+		{
+			result = 1;
+			break;
+		}
+
 		result = pthread_create(&thread_array[n], &thread_attr,
-					sign, (void *) &sign_arg_array[n]);
+					startThread, &thread_start_array[n]);
 		if (result)
 		{
 			log_error("pthread_create() returned %d\n", result);
-			return 1;
+			break;
 		}
 	}
 
+	/* Release the threads, or let them go without working on an error */
+	if (!result && prepare != NULL)
+	{
+		prepare(args, threads, getTime());
+	}
+	openGate(&gate, n, result);
+	threads = n;
+
 	/* Wait for threads to finish */
 	for (n=0; n<threads; n++)
 	{
-		result = pthread_join(thread_array[n], &thread_status);
-		if (result)
+		if (pthread_join(thread_array[n], &thread_status))
 		{
-			log_error("pthread_join() returned %d\n", result);
-			return 1;
+			log_error("pthread_join() failed\n");
+			result = 1;
 		}
 	}
 
-	gettimeofday(&end, NULL);
+	pthread_attr_destroy(&thread_attr);
+	pthread_cond_destroy(&gate.cond);
+	pthread_mutex_destroy(&gate.mutex);
+	free(thread_array);
 
-	/* Report results */
-	end.tv_sec -= start.tv_sec;
-	end.tv_usec-= start.tv_usec;
-	elapsed =(double)(end.tv_sec)+(double)(end.tv_usec)*.000001;
-	speed = iterations / elapsed * threads;
-	if (bits)
+	if (result)
 	{
-		printf("%d %s, %d signatures per thread, %.2f sig/s (%s %i bits)\n",
-		       threads, (threads > 1 ? "threads" : "thread"), iterations,
-		       speed, mechanism, bits);
+		free(thread_start_array);
+		return 1;
 	}
-	else
+
+	firstStart = lastStart = thread_start_array[0].started;
+	firstStop = lastStop = thread_start_array[0].stopped;
+	for (n=0; n<threads; n++)
 	{
-		printf("%d %s, %d signatures per thread, %.2f sig/s (%s)\n",
-		       threads, (threads > 1 ? "threads" : "thread"), iterations,
-		       speed, mechanism);
+		if (thread_start_array[n].started < firstStart) firstStart = thread_start_array[n].started;
+		if (thread_start_array[n].started > lastStart) lastStart = thread_start_array[n].started;
+		if (thread_start_array[n].stopped < firstStop) firstStop = thread_start_array[n].stopped;
+		if (thread_start_array[n].stopped > lastStop) lastStop = thread_start_array[n].stopped;
+		counted += thread_start_array[n].counted;
+		completed += thread_start_array[n].completed;
 	}
+	free(thread_start_array);
 
-	// Remove key
-	rv = p11->C_DestroyObject(hSessionRW, hPublicKey);
-	if (rv != CKR_OK)
+	if (window)
 	{
-		log_error("C_DestroyObject() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		// A thread that stopped before the others had started, for
+		// instance on an error, leaves no window
+		if (gate.windowStop <= gate.windowStart || counted == 0)
+		{
+			log_error("No operation completed while all %u threads "
+				  "were running. Use more iterations.\n", threads);
+			return 1;
+		}
+		throughput = counted / (gate.windowStop - gate.windowStart);
 	}
-	rv = p11->C_DestroyObject(hSessionRW, hPrivateKey);
-	if (rv != CKR_OK)
+	else
 	{
-		log_error("C_DestroyObject() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		if (lastStop <= firstStart || completed == 0)
+		{
+			log_error("No operation completed.\n");
+			return 1;
+		}
+		throughput = completed / (lastStop - firstStart);
+	}
+
+	log_notice("Ramp-up skew %.3f ms, ramp-down skew %.3f ms\n",
+		   (lastStart - firstStart) * 1000, (lastStop - firstStop) * 1000);
+	if (times != NULL)
+	{
+		times->rampUp = lastStart - firstStart;
+		times->rampDown = lastStop - firstStop;
+		times->elapsed = lastStop - firstStart;
+		times->windowStart = gate.windowStart;
+		times->windowStop = gate.windowStop;
+		times->counted = counted;
 	}
 
 	return 0;
 }
 
-int generateRsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+// Allocate the state of the worker threads, each on cache lines of its own
+void* allocThreadArgs(unsigned int count, size_t argSize)
 {
-	CK_KEY_TYPE keyType = CKK_RSA;
-	CK_MECHANISM mechanism = {
-		CKM_RSA_PKCS_KEY_PAIR_GEN, NULL_PTR, 0
-	};
-	CK_BYTE pubExp[] = { 0x01, 0x00, 0x01 };
-	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
-	CK_BYTE id[] = { 0x12, 0x34 };
-	CK_BBOOL bFalse = CK_FALSE;
-	CK_BBOOL bTrue = CK_TRUE;
+	void* args = NULL;
 
-	CK_ATTRIBUTE pukAttribs[] = {
-		{ CKA_LABEL,           &label[0], sizeof(label)   },
-		{ CKA_ID,              &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,        &keyType,  sizeof(keyType) },
-		{ CKA_VERIFY,          &bTrue,    sizeof(bTrue)   },
-		{ CKA_ENCRYPT,         &bFalse,   sizeof(bFalse)  },
-		{ CKA_WRAP,            &bFalse,   sizeof(bFalse)  },
-		{ CKA_TOKEN,           &bTrue,    sizeof(bTrue)   },
-		{ CKA_MODULUS_BITS,    &keysize,  sizeof(keysize) },
-		{ CKA_PUBLIC_EXPONENT, &pubExp,   sizeof(pubExp)  }
-	};
+	if (posix_memalign(&args, CACHE_LINE_SIZE, argSize * count))
+	{
+		log_error("Could not allocate memory.\n");
+		return NULL;
+	}
+	memset(args, 0, argSize * count);
 
-	CK_ATTRIBUTE prkAttribs[] = {
-		{ CKA_LABEL,       &label[0], sizeof(label)   },
-		{ CKA_ID,          &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
-		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
-		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
-		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
-		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
-		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
-		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
-		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
-	};
+	return args;
+}
 
-	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
-					  pukAttribs, 9,
-					  prkAttribs, 10,
-					  &hPuk, &hPrk);
-	if (rv != CKR_OK)
+// Parse the stack size of the threads in KB
+int setStackSize(char* stacksize)
+{
+	char* end;
+	unsigned long size = strtoul(stacksize, &end, 10);
+
+	if (*end != '\0' || size * 1024 < (unsigned long)PTHREAD_STACK_MIN || size > 1048576)
 	{
-		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
-			  (unsigned int)rv);
+		log_error("Invalid stack size: %s [%i-1048576 KB]\n", stacksize,
+			  (int)((PTHREAD_STACK_MIN + 1023) / 1024));
 		return 1;
 	}
+	threadStackSize = size * 1024;
 
 	return 0;
 }
 
-int generateDsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+// Get the pre-defined hash value that matches the hash algorithm
+void getSignData(HashAlgo::Type hashType, CK_BYTE_PTR &data, CK_ULONG &ulDataLen)
 {
-	CK_KEY_TYPE keyType = CKK_DSA;
-	CK_MECHANISM mechanism1 = {
-		CKM_DSA_PARAMETER_GEN, NULL_PTR, 0
-	};
-	CK_MECHANISM mechanism2 = {
-		CKM_DSA_KEY_PAIR_GEN, NULL_PTR, 0
-	};
+	switch (hashType)
+	{
+		case HashAlgo::SHA256:
+		default:
+			data = data256;
+			ulDataLen = sizeof(data256);
+			break;
+		case HashAlgo::SHA384:
+			data = data384;
+			ulDataLen = sizeof(data384);
+			break;
+		case HashAlgo::GOST:
+			data = dataGost;
+			ulDataLen = sizeof(dataGost);
+			break;
+	}
+}
 
-	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
-	CK_BYTE id[] = { 0x12, 0x34 };
-	CK_BBOOL bFalse = CK_FALSE;
-	CK_BBOOL bTrue = CK_TRUE;
+// Print the result of a signature benchmark
+void printSignResult
+(
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details,
+	unsigned int threads,
+	unsigned int iterations,
+	double speed
+)
+{
+	char name[128];
 
-	CK_BYTE dsa_p[512];
-	CK_BYTE dsa_q[32];
-	CK_BYTE dsa_g[512];
+	if (bits)
+	{
+		snprintf(name, sizeof(name), "%s %i bits", mechanism, bits);
+	}
+	else
+	{
+		snprintf(name, sizeof(name), "%s", mechanism);
+	}
 
-	CK_ATTRIBUTE domainTemplate[] = {
-		{ CKA_PRIME_BITS, &keysize, sizeof(keysize) }
-	};
-	CK_OBJECT_HANDLE domainPar;
+	if (details)
+	{
+		printf("%d %s, %d %s per thread, %.2f %s (%s, %s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), iterations,
+		       operation, speed, unit, name, details);
+	}
+	else
+	{
+		printf("%d %s, %d %s per thread, %.2f %s (%s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), iterations,
+		       operation, speed, unit, name);
+	}
+}
 
-	CK_ATTRIBUTE pukAttribs[] = {
-		{ CKA_PRIME,    dsa_p,     sizeof(dsa_p)   },
-		{ CKA_SUBPRIME, dsa_q,     sizeof(dsa_q)   },
-		{ CKA_BASE,     dsa_g,     sizeof(dsa_g)   },
-		{ CKA_LABEL,    &label[0], sizeof(label)   },
-		{ CKA_ID,       &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE, &keyType,  sizeof(keyType) },
-		{ CKA_VERIFY,   &bTrue,    sizeof(bTrue)   },
-		{ CKA_ENCRYPT,  &bFalse,   sizeof(bFalse)  },
-		{ CKA_WRAP,     &bFalse,   sizeof(bFalse)  },
-		{ CKA_TOKEN,    &bTrue,    sizeof(bTrue)   }
-	};
+// Start the measured window and the timetable when the threads are released
+void startSignPhase(void* args, unsigned int threads, double start)
+{
+	sign_arg_t* sign_arg_array = (sign_arg_t*)args;
+	unsigned int n;
 
-	CK_ATTRIBUTE prkAttribs[] = {
-		{ CKA_LABEL,       &label[0], sizeof(label)   },
-		{ CKA_ID,          &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
-		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
-		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
-		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
-		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
-		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
-		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
-		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
-	};
+	for (n=0; n<threads; n++)
+	{
+		sign_arg_array[n].start = start;
+		if (sign_arg_array[n].deadline > 0)
+		{
+			sign_arg_array[n].warmupEnd += start;
+			sign_arg_array[n].deadline += start;
+		}
+	}
+}
 
-	CK_RV rv = p11->C_GenerateKey(hSession, &mechanism1,
-				      domainTemplate, 1,
-				      &domainPar);
-	if (rv != CKR_OK)
+// Run the sign or verify threads and report the result
+int runSignPhase
+(
+	void* (*worker)(void*),
+	sign_arg_t* sign_arg_array,
+	unsigned int threads,
+	unsigned int iterations,
+	double duration,
+	double warmup,
+	double rate,
+	const char* label,
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details,
+	phase_result_t* phaseResult
+)
+{
+	unsigned long counted = 0;
+	double elapsed, throughput;
+	thread_times_t times;
+	histogram_t* histograms;
+	unsigned int n, slot, stripes, failed = 0;
+	int result;
+
+	// Three histograms per thread, for the whole operation, the init call
+	// and the other calls. They are merged into the first ones afterwards.
+	// Above HISTOGRAM_STRIPES threads, the threads share the histograms.
+	stripes = (threads > HISTOGRAM_STRIPES ? HISTOGRAM_STRIPES : threads);
+	histograms = (histogram_t*) malloc(sizeof(histogram_t) * stripes * 3);
+	if (histograms == NULL)
 	{
-		log_error("C_GenerateKey() returned error: rv=%X\n",
-			  (unsigned int)rv);
+		log_error("Could not allocate memory.\n");
 		return 1;
 	}
 
-	rv = p11->C_GetAttributeValue(hSession, domainPar,
-				      pukAttribs, 3);
-	if (rv != CKR_OK)
+	if (duration > 0)
 	{
-		log_error("C_GetAttributeValue() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		log_notice("Running %s %s for %.2f seconds after a %.2f second "
+			   "warm-up using %d %s...\n",
+			   mechanism, operation, duration, warmup,
+			   threads, (threads > 1 ? "threads" : "thread"));
+	}
+	else
+	{
+		log_notice("Running %d %s %s using %d %s...\n",
+			   iterations * threads, mechanism, operation,
+			   threads, (threads > 1 ? "threads" : "thread"));
 	}
 
-	rv = p11->C_DestroyObject(hSession, domainPar);
-	if (rv != CKR_OK)
+	// All threads share the same deadline and timetable, which are moved
+	// to the release of the threads by startSignPhase()
+	for (n=0; n<threads; n++)
 	{
-		log_error("C_DestroyObject() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		sign_arg_array[n].warmupEnd = (duration > 0 ? warmup : 0);
+		sign_arg_array[n].deadline = (duration > 0 ? warmup + duration : 0);
+		sign_arg_array[n].counted = 0;
+		sign_arg_array[n].start = 0;
+		sign_arg_array[n].offset = (rate > 0 ? n / rate : 0);
+		sign_arg_array[n].interval = (rate > 0 ? threads / rate : 0);
+		sign_arg_array[n].histogram = &histograms[n % stripes];
+		sign_arg_array[n].initHistogram = &histograms[stripes + n % stripes];
+		sign_arg_array[n].callHistogram = &histograms[2 * stripes + n % stripes];
+		sign_arg_array[n].histogramShared = (threads > stripes);
+		sign_arg_array[n].failed = 0;
+		sign_arg_array[n].initTime = 0;
+		sign_arg_array[n].callTime = 0;
+		sign_arg_array[n].poolCheckouts = 0;
+		sign_arg_array[n].poolWaits = 0;
+		sign_arg_array[n].stolen = 0;
+	}
+	for (n=0; n<3 * stripes; n++)
+	{
+		histogramReset(&histograms[n]);
 	}
 
-	rv = p11->C_GenerateKeyPair(hSession, &mechanism2,
-				    pukAttribs, 10,
-				    prkAttribs, 10,
-				    &hPuk, &hPrk);
-	if (rv != CKR_OK)
+	// Each slot queues the iterations of the threads that have it as
+	// their home slot
+	for (n=0; n<threads; n++)
 	{
-		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		for (slot=0; slot<sign_arg_array[n].slotCount; slot++)
+		{
+			sign_arg_array[n].slots[slot].counted = 0;
+			sign_arg_array[n].slots[slot].remaining = 0;
+		}
+	}
+	for (n=0; n<threads; n++)
+	{
+		sign_arg_array[n].slots[sign_arg_array[n].home].remaining += iterations;
 	}
 
+	// The worker processes start each phase together
+	if (waitForProcesses())
+	{
+		free(histograms);
+		return 1;
+	}
+
+	result = runThreads(worker, sign_arg_array, sizeof(sign_arg_t),
+			    threads, 1, throughput, startSignPhase, &times);
+
+	// The numbers of a phase where a thread failed are not reported
+	for (n=0; n<threads; n++)
+	{
+		if (sign_arg_array[n].failed) failed++;
+	}
+	if (failed)
+	{
+		log_error("%u of the %u %s threads stopped on an error\n",
+			  failed, threads, label);
+		free(histograms);
+		return 1;
+	}
+	if (result)
+	{
+		free(histograms);
+		return 1;
+	}
+
+	// Only the operations in the steady-state window are counted
+	for (n=0; n<threads; n++)
+	{
+		counted += sign_arg_array[n].counted;
+	}
+
+	// With iterations, the rates of the slots and the modules are scaled to
+	// the throughput while all threads were running
+	elapsed = (duration > 0 ? duration : counted / throughput);
+
+	// With a duration, the measured span is the same for all threads
+	if (duration > 0)
+	{
+		times.windowStart = sign_arg_array[0].warmupEnd;
+		times.windowStop = sign_arg_array[0].deadline;
+		times.counted = counted;
+	}
+
+	if (duration <= 0)
+	{
+		printSignResult(operation, unit, mechanism, bits, details,
+				threads, iterations, throughput);
+	}
+	else
+	{
+		printf("%d %s, %lu %s in %.2f seconds after %.2f seconds warm-up, "
+		       "%.2f %s (%s",
+		       threads, (threads > 1 ? "threads" : "thread"), counted, operation,
+		       duration, warmup, counted / duration, unit, mechanism);
+		if (bits) printf(" %i bits", bits);
+		if (details) printf(", %s", details);
+		printf(")\n");
+	}
+
+	if (rate > 0)
+	{
+		printf("Offered load %.2f %s, latency from the intended start time\n",
+		       rate, unit);
+	}
+
+	for (n=1; n<stripes; n++)
+	{
+		histogramMerge(&histograms[0], &histograms[n]);
+		histogramMerge(&histograms[stripes], &histograms[stripes + n]);
+		histogramMerge(&histograms[2 * stripes], &histograms[2 * stripes + n]);
+	}
+	histogramPrint(label, &histograms[0]);
+	printInitShare(sign_arg_array, threads, label, &histograms[stripes],
+		       &histograms[2 * stripes]);
+	storeProcessResult(threads, counted, counted / elapsed, &times,
+			   &histograms[0], label, operation, unit, mechanism,
+			   bits, details);
+	if (sign_arg_array[0].homePool != NULL)
+	{
+		printSessionPool(sign_arg_array, threads);
+	}
+	printSignSlots(sign_arg_array, threads, operation, unit, elapsed);
+	printSignModules(sign_arg_array, threads, operation, unit, elapsed);
+
+	if (phaseResult != NULL)
+	{
+		phaseResult->threads = threads;
+		phaseResult->sessions = (sign_arg_array[0].homePool != NULL ?
+					 sign_arg_array[0].homePool->count : threads);
+		phaseResult->throughput = counted / elapsed;
+		phaseResult->p50 = histogramPercentile(&histograms[0], 50);
+		phaseResult->p99 = histogramPercentile(&histograms[0], 99);
+	}
+
+	free(histograms);
+
 	return 0;
 }
 
-int generateEcdsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+// Parse a thread range given as "max" or "min..max"
+int getSweepRange(char* sweep, unsigned int &sweepMin, unsigned int &sweepMax)
 {
-	CK_KEY_TYPE keyType = CKK_EC;
-	CK_MECHANISM mechanism = {
-		CKM_EC_KEY_PAIR_GEN, NULL_PTR, 0
+	char* end;
+	unsigned long first, last;
+
+	first = strtoul(sweep, &end, 10);
+	if (strncmp(end, "..", 2) == 0)
+	{
+		last = strtoul(end + 2, &end, 10);
+	}
+	else
+	{
+		last = first;
+		first = 1;
+	}
+
+	if (*end != '\0' || first < 1 || first > last || last > SIGN_THREADS_MAX)
+	{
+		log_error("Invalid thread range: %s [1..%i]\n",
+			  sweep, SIGN_THREADS_MAX);
+		return 1;
+	}
+
+	sweepMin = first;
+	sweepMax = last;
+
+	return 0;
+}
+
+// Run the sign or verify phase at a doubling number of threads and report
+// where the throughput stops growing
+int runSignSweep
+(
+	void* (*worker)(void*),
+	sign_arg_t* sign_arg_array,
+	unsigned int sweepMin,
+	unsigned int sweepMax,
+	unsigned int iterations,
+	double duration,
+	double warmup,
+	const char* label,
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details
+)
+{
+	phase_result_t results[SWEEP_STEPS_MAX];
+	unsigned int threads, steps = 0, n, knee, best = 0;
+
+	for (threads = sweepMin; ; threads *= 2)
+	{
+		if (threads > sweepMax) threads = sweepMax;
+
+		if (runSignPhase(worker, sign_arg_array, threads, iterations,
+				 duration, warmup, 0, label, operation, unit,
+				 mechanism, bits, details, &results[steps]))
+		{
+			return 1;
+		}
+		if (results[steps].throughput > results[best].throughput) best = steps;
+		steps++;
+
+		if (threads == sweepMax) break;
+	}
+
+	// The knee is the first thread count that gets close to the peak
+	for (knee = 0; knee < steps; knee++)
+	{
+		if (results[knee].throughput >= results[best].throughput * SWEEP_KNEE) break;
+	}
+
+	printf("\n%8s %12s %10s %10s\n", "Threads", unit, "p50 ms", "p99 ms");
+	for (n = 0; n < steps; n++)
+	{
+		printf("%8u %12.2f %10.3f %10.3f%s\n",
+		       results[n].threads, results[n].throughput,
+		       results[n].p50 * 1000, results[n].p99 * 1000,
+		       (n == knee && knee < steps - 1 ? "  <- knee" : ""));
+	}
+
+	if (knee == steps - 1)
+	{
+		printf("No saturation found, the throughput still grows at %u threads.\n\n",
+		       results[knee].threads);
+	}
+	else
+	{
+		printf("Saturation at %u threads with %.2f %s, more threads add "
+		       "less than %.0f%% throughput.\n\n",
+		       results[knee].threads, results[knee].throughput, unit,
+		       (1 - SWEEP_KNEE) * 100);
+	}
+
+	return 0;
+}
+
+// Let the threads use the given number of sessions of each pool, which
+// were opened at the largest number of threads
+void setSessionCount(sign_slot_t* signSlots, unsigned int slotCount, unsigned int sessions)
+{
+	unsigned int n;
+
+	for (n=0; n<slotCount; n++)
+	{
+		signSlots[n].pool.count = sessions;
+	}
+}
+
+// Search the number of threads and sessions with the highest throughput
+// whose p99 latency meets the target. The thread count doubles until a
+// trial misses the target, and is then bisected between the last count
+// that met it and the first that did not. Then the sessions of the best
+// thread count are halved for as long as the throughput holds.
+int runSignTune
+(
+	void* (*worker)(void*),
+	sign_arg_t* sign_arg_array,
+	sign_slot_t* signSlots,
+	unsigned int slotCount,
+	unsigned int moduleCount,
+	unsigned int maxThreads,
+	double target,
+	unsigned int iterations,
+	double duration,
+	double warmup,
+	const char* label,
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details
+)
+{
+	phase_result_t results[TUNE_TRIALS_MAX];
+	unsigned int trials = 0, n, best = 0, low = 0, high = maxThreads + 1;
+	unsigned int threads = 1, sessions = 1, gap;
+	int found = 0, met, searchSessions = 0;
+
+	// The thread and the session counts are per module
+	while (trials < TUNE_TRIALS_MAX)
+	{
+		setSessionCount(signSlots, slotCount, sessions);
+		if (runSignPhase(worker, sign_arg_array, threads * moduleCount,
+				 iterations, duration, warmup, 0, label, operation,
+				 unit, mechanism, bits, details, &results[trials]))
+		{
+			setSessionCount(signSlots, slotCount, maxThreads);
+			return 1;
+		}
+		met = (results[trials].p99 <= target);
+		if (met && (!found || results[trials].throughput > results[best].throughput))
+		{
+			best = trials;
+			found = 1;
+		}
+		trials++;
+
+		if (searchSessions)
+		{
+			// Fewer sessions are only kept while they keep up
+			if (!met || sessions == 1 ||
+			    results[trials - 1].throughput < results[best].throughput * SWEEP_KNEE)
+			{
+				break;
+			}
+			sessions /= 2;
+			continue;
+		}
+
+		if (met) low = threads;
+		else high = threads;
+
+		gap = low / TUNE_RESOLUTION;
+		if (gap < 1) gap = 1;
+		if (high > maxThreads && low < maxThreads)
+		{
+			// Double until the target is missed
+			threads = (threads * 2 > maxThreads ? maxThreads : threads * 2);
+		}
+		else if (high <= maxThreads && high - low > gap)
+		{
+			threads = low + (high - low) / 2;
+		}
+		else
+		{
+			// The thread count is known, continue with the sessions
+			if (!found || results[best].threads / moduleCount < 2) break;
+			threads = results[best].threads / moduleCount;
+			sessions = threads / 2;
+			searchSessions = 1;
+			continue;
+		}
+		sessions = threads;
+	}
+
+	setSessionCount(signSlots, slotCount, maxThreads);
+
+	printf("\n%8s %9s %12s %10s %10s\n",
+	       "Threads", "Sessions", unit, "p50 ms", "p99 ms");
+	for (n = 0; n < trials; n++)
+	{
+		printf("%8u %9u %12.2f %10.3f %10.3f%s\n",
+		       results[n].threads, results[n].sessions, results[n].throughput,
+		       results[n].p50 * 1000, results[n].p99 * 1000,
+		       (found && n == best ? "  <- best" :
+			(results[n].p99 > target ? "  over target" : "")));
+	}
+
+	if (!found)
+	{
+		printf("No configuration meets the p99 target of %.3f ms, "
+		       "%u %s %s a p99 of %.3f ms.\n\n",
+		       target * 1000, results[0].threads,
+		       (results[0].threads > 1 ? "threads" : "thread"),
+		       (results[0].threads > 1 ? "have" : "has"),
+		       results[0].p99 * 1000);
+	}
+	else
+	{
+		printf("Best under a p99 of %.3f ms: %u %s with %u %s%s, %.2f %s, "
+		       "p50 %.3f ms, p99 %.3f ms.\n\n",
+		       target * 1000, results[best].threads,
+		       (results[best].threads > 1 ? "threads" : "thread"),
+		       results[best].sessions,
+		       (results[best].sessions > 1 ? "sessions" : "session"),
+		       (slotCount > moduleCount ? " per slot" : ""),
+		       results[best].throughput, unit,
+		       results[best].p50 * 1000, results[best].p99 * 1000);
+	}
+
+	return 0;
+}
+
+// Run the sign or verify phase in turns on side A and side B and report
+// the paired differences. The order of the sides alternates between the
+// trials, so that neither side always runs first.
+int runSignCompare
+(
+	void* (*worker)(void*),
+	sign_arg_t* sideA,
+	sign_arg_t* sideB,
+	unsigned int threads,
+	unsigned int trials,
+	unsigned int iterations,
+	double duration,
+	double warmup,
+	double rate,
+	const char* label,
+	const char* operation,
+	const char* unit,
+	char* mechanism,
+	unsigned int bits,
+	const char* details
+)
+{
+	sign_arg_t* sides[2] = { sideA, sideB };
+	phase_result_t result;
+	double* throughput;
+	double difference, ratio;
+	double sumDiff = 0, sumDiff2 = 0, sumLog = 0, sumLog2 = 0;
+	double meanDiff, meanLog, seDiff = 0, seLog = 0, t;
+	unsigned int n, side, turn;
+
+	// Throughput of A and B per trial
+	throughput = (double*) malloc(sizeof(double) * 2 * trials);
+	if (throughput == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+
+	for (n=0; n<trials; n++)
+	{
+		for (turn=0; turn<2; turn++)
+		{
+			side = (n % 2 ? 1 - turn : turn);
+			log_notice("Trial %u of %u, side %c\n", n + 1, trials,
+				   (side ? 'B' : 'A'));
+			if (runSignPhase(worker, sides[side], threads, iterations,
+					 duration, warmup, rate, label, operation, unit,
+					 mechanism, bits, details, &result))
+			{
+				free(throughput);
+				return 1;
+			}
+			throughput[2 * n + side] = result.throughput;
+		}
+	}
+
+	printf("\n");
+	for (side=0; side<2; side++)
+	{
+		printf("%c: slot %lu of %s\n", (side ? 'B' : 'A'),
+		       sides[side][0].slots[0].slotID,
+		       getModuleName(sides[side][0].modules));
+	}
+	printf("%8s %12s %12s %12s %8s\n", "Trial", "A", "B", "B - A", "B / A");
+	for (n=0; n<trials; n++)
+	{
+		difference = throughput[2 * n + 1] - throughput[2 * n];
+		ratio = (throughput[2 * n] > 0 ? throughput[2 * n + 1] / throughput[2 * n] : 0);
+		printf("%8u %12.2f %12.2f %12.2f %8.3f\n", n + 1,
+		       throughput[2 * n], throughput[2 * n + 1], difference, ratio);
+
+		if (ratio <= 0)
+		{
+			log_error("A trial without any %s cannot be compared.\n",
+				  operation);
+			free(throughput);
+			return 1;
+		}
+		sumDiff += difference;
+		sumDiff2 += difference * difference;
+		sumLog += log(ratio);
+		sumLog2 += log(ratio) * log(ratio);
+	}
+	free(throughput);
+
+	// The speedup is the geometric mean of the ratios, its interval comes
+	// from the mean and the standard error of the log ratios
+	meanDiff = sumDiff / trials;
+	meanLog = sumLog / trials;
+	if (sumDiff2 > trials * meanDiff * meanDiff)
+	{
+		seDiff = sqrt((sumDiff2 - trials * meanDiff * meanDiff) / (trials - 1) / trials);
+	}
+	if (sumLog2 > trials * meanLog * meanLog)
+	{
+		seLog = sqrt((sumLog2 - trials * meanLog * meanLog) / (trials - 1) / trials);
+	}
+	t = getStudentT(trials - 1);
+
+	printf("Mean difference (B - A) %.2f %s, 95%% CI [%.2f, %.2f]\n",
+	       meanDiff, unit, meanDiff - t * seDiff, meanDiff + t * seDiff);
+	printf("Speedup of B over A %.3fx, 95%% CI [%.3fx, %.3fx]\n",
+	       exp(meanLog), exp(meanLog - t * seLog), exp(meanLog + t * seLog));
+	if (meanLog - t * seLog > 0)
+	{
+		printf("B is faster than A.\n\n");
+	}
+	else if (meanLog + t * seLog < 0)
+	{
+		printf("B is slower than A.\n\n");
+	}
+	else
+	{
+		printf("No significant difference between A and B.\n\n");
+	}
+
+	return 0;
+}
+
+// Two-sided 95% critical value of the t distribution
+double getStudentT(unsigned int df)
+{
+	static const double table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
 	};
-	CK_BYTE oidP256[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07 };
-	CK_BYTE oidP384[] = { 0x06, 0x05, 0x2B, 0x81, 0x04, 0x00, 0x22 };
-	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
-	CK_BYTE id[] = { 0x12, 0x34 };
-	CK_BBOOL bFalse = CK_FALSE;
-	CK_BBOOL bTrue = CK_TRUE;
+	const double z = 1.96;
+
+	if (df == 0) return 0;
+	if (df <= sizeof(table) / sizeof(table[0])) return table[df - 1];
+
+	// First-order expansion around the normal distribution
+	return z + (z * z * z + z) / (4 * df);
+}
+
+// Benchmark signing and verification operations
+int testSign
+(
+	module_t* moduleList,
+	unsigned int moduleCount,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	char* datasize,
+	char* chunksize,
+	unsigned int threads,
+	unsigned int sweepMin,
+	unsigned int trials,
+	double target,
+	unsigned int sessions,
+	unsigned int keys,
+	char* distribution,
+	unsigned int iterations,
+	double duration,
+	double warmup,
+	double rate,
+	int doSign,
+	int doVerify
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
+	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
+	CK_KEY_TYPE keyType = CKK_VENDOR_DEFINED;
+	CK_RSA_PKCS_PSS_PARAMS pssParams;
+	CK_MECHANISM mech = { CKM_VENDOR_DEFINED, NULL_PTR, 0 };
+
+	sign_arg_t* sign_arg_array;
+	sign_arg_t* sides[2];
+	sign_slot_t* signSlots;
+	sign_slot_t* home;
+	unsigned int firstSlot[MODULES_MAX];
+	unsigned int slotCount = 0;
+	module_t* module;
+	key_pool_t keyPool = { NULL, NULL, 0, KeyDist::RoundRobin, 0, NULL };
+	char user_pin_copy[MAX_PIN_LEN+1];
+	unsigned int n, m, poolSize, bits = 0;
+	static struct timeval start,end;
+	double elapsed;
+	int result = 1;
+	HashAlgo::Type hashType = HashAlgo::Unknown;
+	CK_BYTE_PTR data = NULL_PTR;
+	CK_BYTE_PTR message = NULL_PTR;
+	CK_ULONG ulDataLen = 0;
+	CK_ULONG ulChunkSize = 0;
+	char details[128] = "";
+	size_t len;
+
+	if (getSignMechanism(mechanism, keysize, mechanismType, keyType, hashType, bits))
+	{
+		return 1;
+	}
+
+	if (getKeyDistribution(distribution, keyPool.distribution, keyPool.exponent))
+	{
+		return 1;
+	}
+
+	mech.mechanism = mechanismType;
+	switch (mechanismType)
+	{
+		case CKM_SHA1_RSA_PKCS_PSS:
+		case CKM_SHA256_RSA_PKCS_PSS:
+		case CKM_SHA384_RSA_PKCS_PSS:
+		case CKM_SHA512_RSA_PKCS_PSS:
+			getPssParams(mechanismType, pssParams);
+			mech.pParameter = &pssParams;
+			mech.ulParameterLen = sizeof(pssParams);
+			break;
+		default:
+			break;
+	}
+
+	// Raw mechanisms sign a pre-defined hash value
+	if (hashType != HashAlgo::None)
+	{
+		if (datasize != NULL || chunksize != NULL)
+		{
+			log_error("The data size and the chunk size can only be used "
+				  "with mechanisms that hash the data.\n");
+			return 1;
+		}
+
+		getSignData(hashType, data, ulDataLen);
+	}
+	else
+	{
+		ulDataLen = SIGN_DATA_SIZE;
+		if (datasize != NULL)
+		{
+			ulDataLen = strtoul(datasize, NULL, 10);
+			if (ulDataLen == 0 || ulDataLen > BULK_MAX_SIZE)
+			{
+				log_error("Invalid data size: "
+					  "%s [1-%i]\n", datasize, BULK_MAX_SIZE);
+				return 1;
+			}
+		}
+		if (chunksize != NULL)
+		{
+			// EdDSA hashes the message twice, so it is single-part only
+			if (keyType == CKK_EC_EDWARDS)
+			{
+				log_error("The chunk size cannot be used with EdDSA.\n");
+				return 1;
+			}
+
+			ulChunkSize = strtoul(chunksize, NULL, 10);
+			if (ulChunkSize == 0 || ulChunkSize > BULK_MAX_SIZE)
+			{
+				log_error("Invalid chunk size: "
+					  "%s [1-%i]\n", chunksize, BULK_MAX_SIZE);
+				return 1;
+			}
+		}
+
+		message = (CK_BYTE_PTR) malloc(ulDataLen);
+		if (message == NULL)
+		{
+			log_error("Could not allocate memory.\n");
+			return 1;
+		}
+		for (CK_ULONG i=0; i<ulDataLen; i++)
+		{
+			message[i] = (CK_BYTE) i;
+		}
+		data = message;
+
+		if (ulChunkSize)
+		{
+			snprintf(details, sizeof(details),
+				 "%lu byte message, multi-part %lu byte chunks",
+				 ulDataLen, ulChunkSize);
+		}
+		else
+		{
+			snprintf(details, sizeof(details),
+				 "%lu byte message, single-part", ulDataLen);
+		}
+	}
+
+	// The slots of all modules are kept in one array
+	for (m=0; m<moduleCount; m++)
+	{
+		firstSlot[m] = slotCount;
+		slotCount += moduleList[m].slotCount;
+	}
+
+	// One PIN for all the slots, so the user is asked only once
+	if (slotCount > 1)
+	{
+		getPW(userPIN, user_pin_copy, CKU_USER);
+		userPIN = user_pin_copy;
+	}
+
+	if (keys > 1)
+	{
+		len = strlen(details);
+		snprintf(details + len, sizeof(details) - len, "%s%u keys, %s",
+			 (len ? ", " : ""), keys,
+			 (distribution ? distribution : "roundrobin"));
+	}
+	if (moduleCount > 1)
+	{
+		len = strlen(details);
+		snprintf(details + len, sizeof(details) - len, "%s%u modules",
+			 (len ? ", " : ""), moduleCount);
+	}
+	if (slotCount > moduleCount)
+	{
+		len = strlen(details);
+		snprintf(details + len, sizeof(details) - len, "%s%u slots",
+			 (len ? ", " : ""), slotCount);
+	}
+
+	signSlots = (sign_slot_t*) calloc(slotCount, sizeof(sign_slot_t));
+	if (signSlots == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		free(message);
+		return 1;
+	}
+	for (m=0; m<moduleCount; m++)
+	{
+		for (n=0; n<moduleList[m].slotCount; n++)
+		{
+			signSlots[firstSlot[m] + n].p11 = moduleList[m].p11;
+			signSlots[firstSlot[m] + n].slotID = moduleList[m].slotList[n];
+			signSlots[firstSlot[m] + n].keys = keyPool;
+		}
+	}
+
+	log_notice("Key generation started...\n");
+	gettimeofday(&start, NULL);
+
+	// Generate keys, each slot gets its own. The set-up uses the global
+	// function list, which is pointed at the module of the slot.
+	for (n=0; n<slotCount; n++)
+	{
+		p11 = signSlots[n].p11;
+		if (openSignSlot(&signSlots[n], userPIN, keyType, bits, keys))
+		{
+			closeSignSlots(signSlots, n + 1);
+			free(message);
+			return 1;
+		}
+	}
+
+	log_notice("Key generation done.\n");
+
+	gettimeofday(&end, NULL);
+	end.tv_sec -= start.tv_sec;
+	end.tv_usec-= start.tv_usec;
+	elapsed =(double)(end.tv_sec)+(double)(end.tv_usec)*.000001;
+	printf("Key generation took %.2f seconds.\n", elapsed);
+
+	for (m=0; m<moduleCount; m++)
+	{
+		// A slot list always uses session pools, so that a thread can take
+		// a session on another slot. By default, a slot can serve all
+		// threads of its module. The sides of a comparison also use pools,
+		// so that their threads are not tied to a session, and the tuner
+		// uses a part of the pool in each trial.
+		poolSize = sessions;
+		if ((moduleList[m].slotCount > 1 || trials || target > 0) && !sessions)
+		{
+			poolSize = threads;
+		}
+
+		for (n=firstSlot[m]; n<firstSlot[m] + moduleList[m].slotCount; n++)
+		{
+			p11 = signSlots[n].p11;
+
+			// Pre-compute the signatures that will be verified
+			if (makeSignatures(&signSlots[n], &mech, data, ulDataLen,
+					   (keys > SIGNATURE_POOL_SIZE ? keys : SIGNATURE_POOL_SIZE),
+					   doVerify))
+			{
+				closeSignSlots(signSlots, slotCount);
+				free(message);
+				return 1;
+			}
+
+			// The threads share a pool of sessions, or each have their own
+			if (poolSize && openSessionPool(signSlots[n].slotID, poolSize,
+							signSlots[n].pool))
+			{
+				closeSignSlots(signSlots, slotCount);
+				free(message);
+				return 1;
+			}
+		}
+	}
+
+	// Every module gets the given number of threads
+	sign_arg_array = (sign_arg_t*) allocThreadArgs(threads * moduleCount,
+							 sizeof(sign_arg_t));
+	if (sign_arg_array == NULL)
+	{
+		closeSignSlots(signSlots, slotCount);
+		free(message);
+		return 1;
+	}
+
+	// Thread n belongs to module n % moduleCount
+	for (n=0; n<threads * moduleCount; n++)
+	{
+		module = &moduleList[n % moduleCount];
+		m = n % moduleCount;
+
+		// The home slot of the thread
+		home = &signSlots[firstSlot[m] + (n / moduleCount) % module->slotCount];
+
+		if (home->pool.count == 0)
+		{
+			rv = module->p11->C_OpenSession(home->slotID, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO);
+			if (rv != CKR_OK)
+			{
+				log_error("C_OpenSession() returned error: rv=%X\n",
+					  (unsigned int)rv);
+				closeSignSlots(signSlots, slotCount);
+				free(sign_arg_array);
+				free(message);
+				return 1;
+			}
+		}
+
+		sign_arg_array[n].id = n;
+		sign_arg_array[n].iterations = iterations;
+		sign_arg_array[n].p11 = module->p11;
+		sign_arg_array[n].modules = moduleList;
+		sign_arg_array[n].moduleCount = moduleCount;
+		sign_arg_array[n].moduleIndex = m;
+		sign_arg_array[n].hSession = hSessionRO;
+		sign_arg_array[n].homePool = (home->pool.count ? &home->pool : NULL);
+		sign_arg_array[n].pool = sign_arg_array[n].homePool;
+		sign_arg_array[n].poolCursor = n;
+		sign_arg_array[n].keys = &home->keys;
+		sign_arg_array[n].keyCursor = n;
+		sign_arg_array[n].random = 0x9E3779B97F4A7C15ULL * (n + 1);
+		sign_arg_array[n].mechanism = &mech;
+		sign_arg_array[n].data = data;
+		sign_arg_array[n].ulDataLen = ulDataLen;
+		sign_arg_array[n].ulChunkSize = ulChunkSize;
+		sign_arg_array[n].signatures = home->signatures;
+		sign_arg_array[n].signatureCount = home->signatureCount;
+		sign_arg_array[n].slots = &signSlots[firstSlot[m]];
+		sign_arg_array[n].slotCount = module->slotCount;
+		sign_arg_array[n].home = (n / moduleCount) % module->slotCount;
+		sign_arg_array[n].slotIndex = sign_arg_array[n].home;
+	}
+
+	// Compare the two slots, A is the first one and B the second one.
+	// Each side gets its own copy of the threads, which only use its slot.
+	if (trials)
+	{
+		sides[0] = (sign_arg_t*) allocThreadArgs(threads, sizeof(sign_arg_t));
+		sides[1] = (sign_arg_t*) allocThreadArgs(threads, sizeof(sign_arg_t));
+		if (sides[0] == NULL || sides[1] == NULL)
+		{
+			free(sides[0]);
+			free(sides[1]);
+			closeSignSlots(signSlots, slotCount);
+			free(sign_arg_array);
+			free(message);
+			return 1;
+		}
+
+		for (m=0; m<2; m++)
+		{
+			// The module of the slot
+			module = &moduleList[moduleCount > 1 ? m : 0];
+			for (n=0; n<threads; n++)
+			{
+				sides[m][n] = sign_arg_array[n];
+				sides[m][n].p11 = signSlots[m].p11;
+				sides[m][n].modules = module;
+				sides[m][n].moduleCount = 1;
+				sides[m][n].moduleIndex = 0;
+				sides[m][n].hSession = CK_INVALID_HANDLE;
+				sides[m][n].homePool = &signSlots[m].pool;
+				sides[m][n].pool = &signSlots[m].pool;
+				sides[m][n].keys = &signSlots[m].keys;
+				sides[m][n].signatures = signSlots[m].signatures;
+				sides[m][n].signatureCount = signSlots[m].signatureCount;
+				sides[m][n].slots = &signSlots[m];
+				sides[m][n].slotCount = 1;
+				sides[m][n].home = 0;
+				sides[m][n].slotIndex = 0;
+			}
+		}
+
+		result = 0;
+		if (doSign)
+		{
+			result = runSignCompare(sign, sides[0], sides[1], threads, trials,
+						iterations, duration, warmup, rate, "Sign",
+						"signatures", "sig/s", mechanism, bits,
+						(details[0] ? details : NULL));
+		}
+		if (doVerify && result == 0)
+		{
+			result = runSignCompare(verify, sides[0], sides[1], threads, trials,
+						iterations, duration, warmup, rate, "Verify",
+						"verifications", "verify/s", mechanism, bits,
+						(details[0] ? details : NULL));
+		}
+
+		free(sides[0]);
+		free(sides[1]);
+		free(sign_arg_array);
+		free(message);
+		if (closeSignSlots(signSlots, slotCount)) return 1;
+
+		return result;
+	}
+
+	// All modules run at the same time
+	threads *= moduleCount;
+	sweepMin *= moduleCount;
+
+	/* Create threads for signing */
+	if (doSign)
+	{
+		if (target > 0)
+		{
+			result = runSignTune(sign, sign_arg_array, signSlots, slotCount,
+					     moduleCount, threads / moduleCount, target,
+					     iterations, duration, warmup, "Sign", "signatures",
+					     "sig/s", mechanism, bits,
+					     (details[0] ? details : NULL));
+		}
+		else if (sweepMin)
+		{
+			result = runSignSweep(sign, sign_arg_array, sweepMin, threads,
+					      iterations, duration, warmup, "Sign",
+					      "signatures", "sig/s", mechanism, bits,
+					      (details[0] ? details : NULL));
+		}
+		else
+		{
+			result = runSignPhase(sign, sign_arg_array, threads, iterations,
+					      duration, warmup, rate, "Sign", "signatures",
+					      "sig/s", mechanism, bits,
+					      (details[0] ? details : NULL), NULL);
+		}
+		if (result)
+		{
+			closeSignSlots(signSlots, slotCount);
+			free(sign_arg_array);
+			free(message);
+			return 1;
+		}
+	}
+
+	/* Create threads for verifying */
+	if (doVerify)
+	{
+		if (target > 0)
+		{
+			result = runSignTune(verify, sign_arg_array, signSlots, slotCount,
+					     moduleCount, threads / moduleCount, target,
+					     iterations, duration, warmup, "Verify", "verifications",
+					     "verify/s", mechanism, bits,
+					     (details[0] ? details : NULL));
+		}
+		else if (sweepMin)
+		{
+			result = runSignSweep(verify, sign_arg_array, sweepMin, threads,
+					      iterations, duration, warmup, "Verify",
+					      "verifications", "verify/s", mechanism, bits,
+					      (details[0] ? details : NULL));
+		}
+		else
+		{
+			result = runSignPhase(verify, sign_arg_array, threads, iterations,
+					      duration, warmup, rate, "Verify", "verifications",
+					      "verify/s", mechanism, bits,
+					      (details[0] ? details : NULL), NULL);
+		}
+		if (result)
+		{
+			closeSignSlots(signSlots, slotCount);
+			free(sign_arg_array);
+			free(message);
+			return 1;
+		}
+	}
+
+	free(sign_arg_array);
+	free(message);
+
+	// Remove keys
+	return closeSignSlots(signSlots, slotCount);
+}
+
+// Log in to a slot and generate its keys
+int openSignSlot
+(
+	sign_slot_t* signSlot,
+	char* userPIN,
+	CK_KEY_TYPE keyType,
+	unsigned int bits,
+	unsigned int keys
+)
+{
+	if (openSession(signSlot->slotID, userPIN, signSlot->hSessionRW))
+	{
+		return 1;
+	}
+
+	return generateKeyPool(signSlot->hSessionRW, keyType, bits, keys,
+			       signSlot->keys);
+}
+
+// Allocate the signatures of a slot, signature n is made with key n % keys.
+// They are only computed when they will be verified.
+int makeSignatures
+(
+	sign_slot_t* signSlot,
+	CK_MECHANISM_PTR mechanism,
+	CK_BYTE_PTR data,
+	CK_ULONG ulDataLen,
+	unsigned int count,
+	int doVerify
+)
+{
+	signature_t* signatures;
+	CK_RV rv;
+	unsigned int n;
+
+	signatures = (signature_t*) malloc(sizeof(signature_t) * count);
+	if (signatures == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+	signSlot->signatures = signatures;
+	signSlot->signatureCount = count;
+
+	if (!doVerify) return 0;
+
+	for (n=0; n<count; n++)
+	{
+		rv = p11->C_SignInit(signSlot->hSessionRW, mechanism,
+				     signSlot->keys.hPrivateKeys[n % signSlot->keys.count]);
+		if (rv != CKR_OK)
+		{
+			log_error("C_SignInit() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+
+		signatures[n].ulSignatureLen = sizeof(signatures[n].signature);
+		rv = p11->C_Sign(signSlot->hSessionRW, data, ulDataLen,
+				 signatures[n].signature,
+				 &signatures[n].ulSignatureLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_Sign() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Free the sessions and the signatures of the slots and remove their keys
+int closeSignSlots(sign_slot_t* signSlots, unsigned int slotCount)
+{
+	unsigned int n;
+	int result = 0;
+
+	for (n=0; n<slotCount; n++)
+	{
+		p11 = signSlots[n].p11;
+		freeSessionPool(signSlots[n].pool);
+		free(signSlots[n].signatures);
+		if (destroyKeyPool(signSlots[n].hSessionRW, signSlots[n].keys))
+		{
+			result = 1;
+		}
+	}
+	free(signSlots);
+
+	return result;
+}
+
+// Parse a slot number or a comma-separated list of slot numbers
+int getSlotList(char* slot, CK_SLOT_ID* slotList, unsigned int &slotCount)
+{
+	char* next = slot;
+	char* end;
+	unsigned long id;
+	unsigned int n;
+
+	slotCount = 0;
+	for (;;)
+	{
+		id = strtoul(next, &end, 10);
+		if (end == next || (*end != ',' && *end != '\0') ||
+		    slotCount == SLOTS_MAX)
+		{
+			log_error("Invalid slot list: %s [at most %i slots]\n",
+				  slot, SLOTS_MAX);
+			return 1;
+		}
+		for (n=0; n<slotCount; n++)
+		{
+			if (slotList[n] == id)
+			{
+				log_error("Slot %lu is listed more than once\n", id);
+				return 1;
+			}
+		}
+		slotList[slotCount++] = id;
+
+		if (*end == '\0') break;
+		next = end + 1;
+	}
+
+	return 0;
+}
+
+// Parse the key distribution: roundrobin, uniform or zipf:<exponent>
+int getKeyDistribution(char* distribution, KeyDist::Type &type, double &exponent)
+{
+	char* end;
+
+	if (distribution == NULL || strcmp(distribution, "roundrobin") == 0)
+	{
+		type = KeyDist::RoundRobin;
+		return 0;
+	}
+
+	if (strcmp(distribution, "uniform") == 0)
+	{
+		type = KeyDist::Uniform;
+		return 0;
+	}
+
+	if (strncmp(distribution, "zipf:", 5) == 0)
+	{
+		exponent = strtod(distribution + 5, &end);
+		if (end != distribution + 5 && *end == '\0' && exponent > 0)
+		{
+			type = KeyDist::Zipf;
+			return 0;
+		}
+	}
+
+	log_error("Unknown key distribution: %s [roundrobin, uniform, zipf:<s>]\n",
+		  distribution);
+	return 1;
+}
+
+// Generate the key pairs used by the sign and verify threads
+int generateKeyPool
+(
+	CK_SESSION_HANDLE hSession,
+	CK_KEY_TYPE keyType,
+	unsigned int bits,
+	unsigned int keys,
+	key_pool_t &keyPool
+)
+{
+	double sum = 0;
+	unsigned int n;
+
+	keyPool.hPublicKeys = (CK_OBJECT_HANDLE*) malloc(sizeof(CK_OBJECT_HANDLE) * keys);
+	keyPool.hPrivateKeys = (CK_OBJECT_HANDLE*) malloc(sizeof(CK_OBJECT_HANDLE) * keys);
+	if (keyPool.hPublicKeys == NULL || keyPool.hPrivateKeys == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+
+	for (n=0; n<keys; n++)
+	{
+		if (generateKeyPair(hSession, keyType, bits,
+				    keyPool.hPublicKeys[n], keyPool.hPrivateKeys[n]))
+		{
+			return 1;
+		}
+		keyPool.count++;
+	}
+
+	if (keyPool.distribution != KeyDist::Zipf) return 0;
+
+	// Cumulative probability of the keys, key n has weight 1 / (n + 1)^s
+	keyPool.cdf = (double*) malloc(sizeof(double) * keys);
+	if (keyPool.cdf == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+	for (n=0; n<keys; n++)
+	{
+		sum += 1 / pow(n + 1, keyPool.exponent);
+		keyPool.cdf[n] = sum;
+	}
+	for (n=0; n<keys; n++)
+	{
+		keyPool.cdf[n] /= sum;
+	}
+	keyPool.cdf[keys - 1] = 1;
+
+	return 0;
+}
+
+// Remove the keys and free the pool
+int destroyKeyPool(CK_SESSION_HANDLE hSession, key_pool_t &keyPool)
+{
+	CK_RV rv;
+	unsigned int n;
+	int result = 0;
+
+	for (n=0; n<keyPool.count; n++)
+	{
+		rv = p11->C_DestroyObject(hSession, keyPool.hPublicKeys[n]);
+		if (rv == CKR_OK)
+		{
+			rv = p11->C_DestroyObject(hSession, keyPool.hPrivateKeys[n]);
+		}
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			result = 1;
+			break;
+		}
+	}
+
+	free(keyPool.hPublicKeys);
+	free(keyPool.hPrivateKeys);
+	free(keyPool.cdf);
+	keyPool.hPublicKeys = NULL;
+	keyPool.hPrivateKeys = NULL;
+	keyPool.cdf = NULL;
+	keyPool.count = 0;
+
+	return result;
+}
+
+// xorshift64* generator, one state per thread
+unsigned long long nextRandom(unsigned long long &state)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return state * 2685821657736338717ULL;
+}
+
+// Pick the key for the next operation of the thread
+unsigned int selectKey(sign_arg_t* sign_arg)
+{
+	key_pool_t* keyPool = sign_arg->keys;
+	unsigned int low, high, middle;
+	double u;
+
+	if (keyPool->count == 1) return 0;
+
+	switch (keyPool->distribution)
+	{
+		case KeyDist::Uniform:
+			return nextRandom(sign_arg->random) % keyPool->count;
+		case KeyDist::Zipf:
+			// Uniform in [0, 1) from the top 53 bits
+			u = (nextRandom(sign_arg->random) >> 11) * (1.0 / 9007199254740992.0);
+
+			// The first key with a cumulative probability above u
+			low = 0;
+			high = keyPool->count - 1;
+			while (low < high)
+			{
+				middle = (low + high) / 2;
+				if (keyPool->cdf[middle] > u)
+				{
+					high = middle;
+				}
+				else
+				{
+					low = middle + 1;
+				}
+			}
+			return low;
+		default:
+			return sign_arg->keyCursor++ % keyPool->count;
+	}
+}
+
+// Translate the symmetric mechanism name and key size given on the command line
+int getCipherMechanism
+(
+	char* mechanism,
+	char* keysize,
+	CK_MECHANISM_TYPE &mechanismType,
+	unsigned int &bits
+)
+{
+	bits = 0;
+
+	if (mechanism == NULL)
+	{
+		log_error("A mechanism must be supplied. "
+			  "Use --mechanism <mech>\n");
+		return 1;
+	}
+
+	if (strcmp(mechanism, "AES_CBC") == 0)
+	{
+		mechanismType = CKM_AES_CBC;
+	}
+	else if (strcmp(mechanism, "AES_CTR") == 0)
+	{
+		mechanismType = CKM_AES_CTR;
+	}
+	else if (strcmp(mechanism, "AES_GCM") == 0)
+	{
+		mechanismType = CKM_AES_GCM;
+	}
+	else
+	{
+		log_error("Unknown cipher mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+
+	if (keysize == NULL)
+	{
+		log_error("A key size must be supplied. "
+			  "Use --keysize <bits>\n");
+		return 1;
+	}
+
+	bits = atoi(keysize);
+	if (bits != 128 && bits != 192 && bits != 256)
+	{
+		log_error("Invalid key size: "
+			  "%i [128, 192, 256]\n", bits);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Get the data sizes that should be benchmarked and the chunk size
+int getBulkSizes
+(
+	char* datasize,
+	char* chunksize,
+	CK_ULONG* sizes,
+	unsigned int &sizeCount,
+	CK_ULONG &ulChunkSize,
+	CK_ULONG ulBlockSize
+)
+{
+	if (datasize == NULL)
+	{
+		sizeCount = sizeof(bulk_sizes) / sizeof(bulk_sizes[0]);
+		memcpy(sizes, bulk_sizes, sizeof(bulk_sizes));
+	}
+	else
+	{
+		sizes[0] = strtoul(datasize, NULL, 10);
+		sizeCount = 1;
+		if (sizes[0] == 0 || sizes[0] > BULK_MAX_SIZE)
+		{
+			log_error("Invalid data size: "
+				  "%s [1-%i]\n", datasize, BULK_MAX_SIZE);
+			return 1;
+		}
+		if (sizes[0] % ulBlockSize)
+		{
+			log_error("The data size must be a multiple of "
+				  "%lu bytes for this mechanism.\n", ulBlockSize);
+			return 1;
+		}
+	}
+
+	if (chunksize == NULL)
+	{
+		ulChunkSize = BULK_CHUNK_SIZE;
+	}
+	else
+	{
+		ulChunkSize = strtoul(chunksize, NULL, 10);
+		if (ulChunkSize == 0 || ulChunkSize > BULK_MAX_SIZE)
+		{
+			log_error("Invalid chunk size: "
+				  "%s [1-%i]\n", chunksize, BULK_MAX_SIZE);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Translate the digest or HMAC mechanism name given on the command line
+int getHashMechanism
+(
+	char* mechanism,
+	BulkOp::Type operation,
+	CK_MECHANISM_TYPE &mechanismType
+)
+{
+	if (mechanism == NULL)
+	{
+		log_error("A mechanism must be supplied. "
+			  "Use --mechanism <mech>\n");
+		return 1;
+	}
+
+	if (operation == BulkOp::Digest)
+	{
+		if (strcmp(mechanism, "SHA1") == 0)
+		{
+			mechanismType = CKM_SHA_1;
+			return 0;
+		}
+		else if (strcmp(mechanism, "SHA256") == 0)
+		{
+			mechanismType = CKM_SHA256;
+			return 0;
+		}
+		else if (strcmp(mechanism, "SHA384") == 0)
+		{
+			mechanismType = CKM_SHA384;
+			return 0;
+		}
+		else if (strcmp(mechanism, "SHA512") == 0)
+		{
+			mechanismType = CKM_SHA512;
+			return 0;
+		}
+		else if (strcmp(mechanism, "GOSTR3411") == 0)
+		{
+			mechanismType = CKM_GOSTR3411;
+			return 0;
+		}
+
+		log_error("Unknown digest mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+
+	if (strcmp(mechanism, "SHA1_HMAC") == 0)
+	{
+		mechanismType = CKM_SHA_1_HMAC;
+	}
+	else if (strcmp(mechanism, "SHA256_HMAC") == 0)
+	{
+		mechanismType = CKM_SHA256_HMAC;
+	}
+	else if (strcmp(mechanism, "SHA384_HMAC") == 0)
+	{
+		mechanismType = CKM_SHA384_HMAC;
+	}
+	else if (strcmp(mechanism, "SHA512_HMAC") == 0)
+	{
+		mechanismType = CKM_SHA512_HMAC;
+	}
+	else if (strcmp(mechanism, "GOSTR3411_HMAC") == 0)
+	{
+		mechanismType = CKM_GOSTR3411_HMAC;
+	}
+	else
+	{
+		log_error("Unknown HMAC mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+// Run the single-part and the multi-part variant of a bulk operation
+int runBulk
+(
+	bulk_arg_t* bulk_arg_array,
+	unsigned int threads,
+	unsigned int iterations,
+	BulkOp::Type operation,
+	CK_BYTE_PTR input,
+	CK_ULONG ulInputLen,
+	CK_ULONG ulChunkSize,
+	char* mechanism,
+	unsigned int bits,
+	double &speedSingle
+)
+{
+	double speed;
+	unsigned int n;
+	int multi;
+
+	for (multi=0; multi<2; multi++)
+	{
+		// No chunk size means that there is no multi-part variant
+		if (multi && ulChunkSize == 0) break;
+
+		for (n=0; n<threads; n++)
+		{
+			bulk_arg_array[n].operation = operation;
+			bulk_arg_array[n].input = input;
+			bulk_arg_array[n].ulInputLen = ulInputLen;
+			bulk_arg_array[n].ulChunkSize = (multi ? ulChunkSize : 0);
+		}
+
+		if (runThreads(bulk, bulk_arg_array, sizeof(bulk_arg_t),
+			       threads, 0, speed, NULL, NULL))
+		{
+			return 1;
+		}
+
+		printBulkResult(operation, mechanism, bits, threads, iterations,
+				ulInputLen, (multi ? ulChunkSize : 0), speed);
+
+		if (!multi) speedSingle = speed;
+	}
+
+	return 0;
+}
+
+// Run a bulk operation for each of the data sizes
+int runBulkSweep
+(
+	bulk_arg_t* bulk_arg_array,
+	CK_SESSION_HANDLE hSession,
+	unsigned int threads,
+	unsigned int iterations,
+	BulkOp::Type operation,
+	CK_ULONG* sizes,
+	unsigned int sizeCount,
+	CK_ULONG ulChunkSize,
+	char* mechanism,
+	unsigned int bits
+)
+{
+	CK_ULONG inputLens[sizeof(bulk_sizes) / sizeof(bulk_sizes[0])];
+	double opTimes[sizeof(bulk_sizes) / sizeof(bulk_sizes[0])];
+	double speed;
+	int result = 0;
+
+	for (unsigned int s=0; s<sizeCount && result == 0; s++)
+	{
+		CK_ULONG ulDataLen = sizes[s];
+		CK_ULONG ulInputLen = ulDataLen;
+		CK_BYTE_PTR data = (CK_BYTE_PTR) malloc(ulDataLen);
+		CK_BYTE_PTR input = (CK_BYTE_PTR) malloc(ulDataLen + BULK_OUTPUT_OVERHEAD);
+		if (!data || !input)
+		{
+			log_error("Could not allocate memory.\n");
+			free(data);
+			free(input);
+			return 1;
+		}
+
+		for (CK_ULONG i=0; i<ulDataLen; i++)
+		{
+			data[i] = (CK_BYTE) i;
+		}
+		memcpy(input, data, ulDataLen);
+
+		// Create the cipher text that will be decrypted. With AES-GCM,
+		// each data size gets an IV of its own, which the decrypting
+		// threads then share.
+		if (operation == BulkOp::Decrypt)
+		{
+			CK_MECHANISM_PTR mech = bulk_arg_array[0].mechanism;
+			CK_RV rv;
+
+			if (mech->mechanism == CKM_AES_GCM)
+			{
+				setGcmIv(((CK_GCM_PARAMS*)mech->pParameter)->pIv, 0, s);
+			}
+
+			ulInputLen = ulDataLen + BULK_OUTPUT_OVERHEAD;
+			rv = p11->C_EncryptInit(hSession, mech,
+						bulk_arg_array[0].hKey);
+			if (rv == CKR_OK)
+			{
+				rv = p11->C_Encrypt(hSession, data, ulDataLen,
+						    input, &ulInputLen);
+			}
+			if (rv != CKR_OK)
+			{
+				log_error("C_Encrypt() returned error: rv=%X\n",
+					  (unsigned int)rv);
+				logGcmIvError(mech, rv);
+				result = 1;
+			}
+		}
+
+		if (result == 0)
+		{
+			log_notice("Running %d %s of %lu bytes using %d %s...\n",
+				   iterations * threads, bulk_operations[operation],
+				   ulInputLen, threads,
+				   (threads > 1 ? "threads" : "thread"));
+
+			result = runBulk(bulk_arg_array, threads, iterations,
+					 operation, input, ulInputLen,
+					 ulChunkSize, mechanism, bits, speed);
+
+			inputLens[s] = ulInputLen;
+			opTimes[s] = 1 / speed;
+		}
+
+		free(data);
+		free(input);
+	}
+
+	if (result == 0 && sizeCount > 1)
+	{
+		printBulkCrossover(operation, inputLens, opTimes, sizeCount);
+	}
+
+	return result;
+}
+
+// Print the result of a bulk benchmark
+void printBulkResult
+(
+	BulkOp::Type operation,
+	char* mechanism,
+	unsigned int bits,
+	unsigned int threads,
+	unsigned int iterations,
+	CK_ULONG ulDataLen,
+	CK_ULONG ulChunkSize,
+	double speed
+)
+{
+	double bytes = speed * ulDataLen / 1000000;
+	char details[64];
+
+	if (operation == BulkOp::Random)
+	{
+		printf("%d %s, %d %s of %lu bytes per thread, %.2f MB/s, %.2f %s "
+		       "(%s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), iterations,
+		       bulk_operations[operation], ulDataLen, bytes, speed,
+		       bulk_units[operation], mechanism);
+		return;
+	}
+
+	if (ulChunkSize)
+	{
+		snprintf(details, sizeof(details), "multi-part %lu byte chunks",
+			 ulChunkSize);
+	}
+	else
+	{
+		snprintf(details, sizeof(details), "single-part");
+	}
+
+	if (bits)
+	{
+		printf("%d %s, %d %s of %lu bytes per thread, %.2f MB/s, %.2f %s "
+		       "(%s %i bits, %s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), iterations,
+		       bulk_operations[operation], ulDataLen, bytes, speed,
+		       bulk_units[operation], mechanism, bits, details);
+	}
+	else
+	{
+		printf("%d %s, %d %s of %lu bytes per thread, %.2f MB/s, %.2f %s "
+		       "(%s, %s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), iterations,
+		       bulk_operations[operation], ulDataLen, bytes, speed,
+		       bulk_units[operation], mechanism, details);
+	}
+}
+
+// Estimate the per-call overhead and the bulk throughput of the single-part
+// operation. The time per operation is modelled as overhead + size / speed,
+// and the crossover is the data size where both parts take equally long.
+// The fit is weighted with the relative error, so that the small data sizes
+// count as much as the large ones.
+void printBulkCrossover
+(
+	BulkOp::Type operation,
+	CK_ULONG* sizes,
+	double* opTimes,
+	unsigned int sizeCount
+)
+{
+	double sumW = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+	double slope, overhead;
+
+	for (unsigned int s=0; s<sizeCount; s++)
+	{
+		double x = sizes[s];
+		double y = opTimes[s];
+		double w;
+
+		if (y <= 0) return;
+		w = 1 / (y * y);
+
+		sumW += w;
+		sumX += w * x;
+		sumY += w * y;
+		sumXX += w * x * x;
+		sumXY += w * x * y;
+	}
+
+	if (sumW * sumXX - sumX * sumX <= 0) return;
+
+	slope = (sumW * sumXY - sumX * sumY) / (sumW * sumXX - sumX * sumX);
+	overhead = (sumY - slope * sumX) / sumW;
+
+	if (slope <= 0 || overhead <= 0)
+	{
+		printf("Could not estimate the call overhead of the %s.\n",
+		       bulk_operations[operation]);
+		return;
+	}
+
+	printf("Single-part %s: %.2f us call overhead, %.2f MB/s bulk throughput, "
+	       "crossover at %.0f bytes\n",
+	       bulk_operations[operation], overhead * 1000000,
+	       1 / slope / 1000000, overhead / slope);
+}
+
+// Open a session for each thread
+int openBulkSessions
+(
+	unsigned int slot,
+	bulk_arg_t* bulk_arg_array,
+	unsigned int threads,
+	unsigned int iterations,
+	CK_OBJECT_HANDLE hKey,
+	CK_MECHANISM_PTR mechanism
+)
+{
+	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
+
+	for (unsigned int n=0; n<threads; n++)
+	{
+		CK_RV rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR,
+					      NULL_PTR, &hSessionRO);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+
+		bulk_arg_array[n].id = n;
+		bulk_arg_array[n].iterations = iterations;
+		bulk_arg_array[n].hSession = hSessionRO;
+		bulk_arg_array[n].hKey = hKey;
+		bulk_arg_array[n].mechanism = mechanism;
+	}
+
+	return 0;
+}
+
+// Benchmark symmetric encryption and decryption operations
+int testCipher
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	char* datasize,
+	char* chunksize,
+	unsigned int threads,
+	unsigned int iterations,
+	int doEncrypt,
+	int doDecrypt
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
+	CK_OBJECT_HANDLE hKey = CK_INVALID_HANDLE;
+
+	bulk_arg_t* bulk_arg_array;
+	CK_ULONG sizes[sizeof(bulk_sizes) / sizeof(bulk_sizes[0])];
+	CK_ULONG ulChunkSize, ulBlockSize = 1;
+	unsigned int sizeCount, bits = 0;
+	static struct timeval start,end;
+	double elapsed;
+	int result = 1;
+
+	CK_BYTE iv[16];
+	CK_AES_CTR_PARAMS ctrParams;
+	CK_GCM_PARAMS gcmParams;
+	CK_MECHANISM mech = { CKM_VENDOR_DEFINED, NULL_PTR, 0 };
+
+	if (getCipherMechanism(mechanism, keysize, mechanismType, bits))
+	{
+		return 1;
+	}
+
+	// The same IV is used for every operation, which is fine for a benchmark.
+	// AES-GCM encryption takes a new IV each time, see nextGcmIv().
+	memset(iv, 0, sizeof(iv));
+	mech.mechanism = mechanismType;
+	switch (mechanismType)
+	{
+		case CKM_AES_CBC:
+			mech.pParameter = iv;
+			mech.ulParameterLen = sizeof(iv);
+			ulBlockSize = 16;
+			break;
+		case CKM_AES_CTR:
+			memset(&ctrParams, 0, sizeof(ctrParams));
+			ctrParams.ulCounterBits = 128;
+			mech.pParameter = &ctrParams;
+			mech.ulParameterLen = sizeof(ctrParams);
+			break;
+		case CKM_AES_GCM:
+			memset(&gcmParams, 0, sizeof(gcmParams));
+			gcmParams.pIv = iv;
+			gcmParams.ulIvLen = GCM_IV_SIZE;
+			gcmParams.ulIvBits = GCM_IV_SIZE * 8;
+			gcmParams.ulTagBits = 128;
+			mech.pParameter = &gcmParams;
+			mech.ulParameterLen = sizeof(gcmParams);
+			break;
+		default:
+			break;
+	}
+
+	if (getBulkSizes(datasize, chunksize, sizes, sizeCount,
+			 ulChunkSize, ulBlockSize))
+	{
+		return 1;
+	}
+
+	if (openSession(slot, userPIN, hSessionRW))
+	{
+		return 1;
+	}
+
+	log_notice("Key generation started...\n");
+	gettimeofday(&start, NULL);
+
+	// Generate key
+	result = generateAes(hSessionRW, bits, hKey, KeyUsage::Encrypt);
+	if (result != 0) return result;
+
+	log_notice("Key generation done.\n");
+
+	gettimeofday(&end, NULL);
+	end.tv_sec -= start.tv_sec;
+	end.tv_usec-= start.tv_usec;
+	elapsed =(double)(end.tv_sec)+(double)(end.tv_usec)*.000001;
+	printf("Key generation took %.2f seconds.\n", elapsed);
+
+	// The key is removed on every path from here on
+	bulk_arg_array = (bulk_arg_t*) allocThreadArgs(threads, sizeof(bulk_arg_t));
+	if (bulk_arg_array == NULL ||
+	    openBulkSessions(slot, bulk_arg_array, threads, iterations, hKey, &mech))
+	{
+		result = 1;
+	}
+
+	if (doEncrypt && result == 0)
+	{
+		result = runBulkSweep(bulk_arg_array, hSessionRW, threads, iterations,
+				      BulkOp::Encrypt, sizes, sizeCount,
+				      ulChunkSize, mechanism, bits);
+	}
+
+	if (doDecrypt && result == 0)
+	{
+		result = runBulkSweep(bulk_arg_array, hSessionRW, threads, iterations,
+				      BulkOp::Decrypt, sizes, sizeCount,
+				      ulChunkSize, mechanism, bits);
+	}
+
+	free(bulk_arg_array);
+
+	// Remove key
+	rv = p11->C_DestroyObject(hSessionRW, hKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return result;
+}
+
+// Benchmark digest or HMAC operations
+int testHash
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	char* datasize,
+	char* chunksize,
+	unsigned int threads,
+	unsigned int iterations,
+	BulkOp::Type operation
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
+	CK_OBJECT_HANDLE hKey = CK_INVALID_HANDLE;
+
+	bulk_arg_t* bulk_arg_array;
+	CK_ULONG sizes[sizeof(bulk_sizes) / sizeof(bulk_sizes[0])];
+	CK_ULONG ulChunkSize;
+	unsigned int sizeCount, bits = 0;
+	int result = 1;
+
+	if (getHashMechanism(mechanism, operation, mechanismType))
+	{
+		return 1;
+	}
+
+	CK_MECHANISM mech = { mechanismType, NULL_PTR, 0 };
+
+	if (operation == BulkOp::Mac)
+	{
+		bits = HMAC_KEY_SIZE;
+		if (keysize != NULL)
+		{
+			bits = atoi(keysize);
+		}
+		if (bits < 8 || bits > 4096 || bits % 8)
+		{
+			log_error("Invalid key size: "
+				  "%i [8-4096, multiple of 8]\n", bits);
+			return 1;
+		}
+	}
+
+	if (getBulkSizes(datasize, chunksize, sizes, sizeCount,
+			 ulChunkSize, 1))
+	{
+		return 1;
+	}
+
+	// A digest does not need a key, so there is no need to login
+	if (operation == BulkOp::Digest)
+	{
+		rv = p11->C_OpenSession((CK_SLOT_ID)slot, CKF_SERIAL_SESSION,
+					NULL_PTR, NULL_PTR, &hSessionRW);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+	else
+	{
+		if (openSession(slot, userPIN, hSessionRW))
+		{
+			return 1;
+		}
+
+		result = generateGenericSecret(hSessionRW, bits, hKey);
+		if (result != 0) return result;
+	}
+
+	bulk_arg_array = (bulk_arg_t*) allocThreadArgs(threads, sizeof(bulk_arg_t));
+	if (bulk_arg_array == NULL)
+	{
+		return 1;
+	}
+
+	if (openBulkSessions(slot, bulk_arg_array, threads, iterations, hKey, &mech))
+	{
+		free(bulk_arg_array);
+		return 1;
+	}
+
+	result = runBulkSweep(bulk_arg_array, hSessionRW, threads, iterations,
+			      operation, sizes, sizeCount,
+			      ulChunkSize, mechanism, bits);
+	free(bulk_arg_array);
+	if (result != 0) return result;
+
+	// Remove key
+	if (hKey != CK_INVALID_HANDLE)
+	{
+		rv = p11->C_DestroyObject(hSessionRW, hKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Get the time in seconds from a monotonic clock
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * .000000001;
+}
+
+// Sleep until the given getTime() value
+void sleepUntil(double time)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)time;
+	ts.tv_nsec = (long)((time - (double)ts.tv_sec) * 1000000000);
+	if (ts.tv_nsec > 999999999) ts.tv_nsec = 999999999;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+// Benchmark key pair generation
+int testKeygen
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	unsigned int threads,
+	unsigned int iterations
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession = CK_INVALID_HANDLE;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
+	CK_KEY_TYPE keyType = CKK_VENDOR_DEFINED;
+
+	keygen_arg_t* keygen_arg_array;
+	unsigned int n, bits = 0;
+	unsigned long generated = 0;
+	double speed;
+	thread_times_t times;
+	histogram_t* histograms;
+	HashAlgo::Type hashType = HashAlgo::Unknown;
+
+	if (getSignMechanism(mechanism, keysize, mechanismType, keyType, hashType, bits))
+	{
+		return 1;
+	}
+
+	if (openSession(slot, userPIN, hSessionRW))
+	{
+		return 1;
+	}
+
+	histograms = (histogram_t*) malloc(sizeof(histogram_t) * threads);
+	if (histograms == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+	keygen_arg_array = (keygen_arg_t*) allocThreadArgs(threads, sizeof(keygen_arg_t));
+	if (keygen_arg_array == NULL)
+	{
+		free(histograms);
+		return 1;
+	}
+
+	// The key objects are created, so the sessions must be read-write
+	for (n=0; n<threads; n++)
+	{
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION | CKF_RW_SESSION,
+					NULL_PTR, NULL_PTR, &hSession);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			free(keygen_arg_array);
+			free(histograms);
+			return 1;
+		}
+
+		keygen_arg_array[n].id = n;
+		keygen_arg_array[n].iterations = iterations;
+		keygen_arg_array[n].hSession = hSession;
+		keygen_arg_array[n].keyType = keyType;
+		keygen_arg_array[n].bits = bits;
+		keygen_arg_array[n].histogram = &histograms[n];
+		keygen_arg_array[n].generated = 0;
+		histogramReset(&histograms[n]);
+	}
+
+	log_notice("Generating %d %s key pairs using %d %s...\n",
+		   iterations * threads, mechanism,
+		   threads, (threads > 1 ? "threads" : "thread"));
+
+	/* Create threads for key generation */
+	if (runThreads(keygen, keygen_arg_array, sizeof(keygen_arg_t),
+		       threads, 0, speed, NULL, &times))
+	{
+		free(keygen_arg_array);
+		free(histograms);
+		return 1;
+	}
+
+	// Merge the latencies of the successful key generations
+	for (n=0; n<threads; n++)
+	{
+		if (n) histogramMerge(&histograms[0], &histograms[n]);
+		generated += keygen_arg_array[n].generated;
+	}
+
+	// The key pairs of all threads over the whole run, the RSA prime
+	// search lets the threads finish at quite different times
+	speed = generated / times.elapsed;
+
+	/* Report results */
+	if (bits)
+	{
+		printf("%d %s, %lu key pairs, %.2f keys/s (%s %i bits)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), generated,
+		       speed, mechanism, bits);
+	}
+	else
+	{
+		printf("%d %s, %lu key pairs, %.2f keys/s (%s)\n",
+		       threads, (threads > 1 ? "threads" : "thread"), generated,
+		       speed, mechanism);
+	}
+	histogramPrint("Key generation", &histograms[0]);
+
+	free(keygen_arg_array);
+	free(histograms);
+
+	return (generated == (unsigned long)threads * iterations ? 0 : 1);
+}
+
+// Count the objects that are visible in the session
+int countObjects(CK_SESSION_HANDLE hSession, CK_ULONG &count)
+{
+	CK_RV rv;
+	CK_OBJECT_HANDLE hObjects[64];
+	CK_ULONG ulObjectCount;
+
+	count = 0;
+
+	rv = p11->C_FindObjectsInit(hSession, NULL_PTR, 0);
+	if (rv != CKR_OK)
+	{
+		log_error("C_FindObjectsInit() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	do
+	{
+		rv = p11->C_FindObjects(hSession, hObjects, 64, &ulObjectCount);
+		if (rv != CKR_OK)
+		{
+			log_error("C_FindObjects() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			p11->C_FindObjectsFinal(hSession);
+			return 1;
+		}
+		count += ulObjectCount;
+	} while (ulObjectCount > 0);
+
+	rv = p11->C_FindObjectsFinal(hSession);
+	if (rv != CKR_OK)
+	{
+		log_error("C_FindObjectsFinal() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Get the EC point of a public key without the DER OCTET STRING wrapping
+int getEcPoint(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hPuk, ec_point_t &point)
+{
+	CK_RV rv;
+	CK_BYTE value[EC_POINT_MAX_SIZE + 3];
+	CK_ULONG ulHeaderLen = 0;
+	CK_ULONG ulPointLen = 0;
+	CK_ATTRIBUTE attribs[] = {
+		{ CKA_EC_POINT, value, sizeof(value) }
+	};
+
+	rv = p11->C_GetAttributeValue(hSession, hPuk, attribs, 1);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GetAttributeValue() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	// Some libraries return the raw point instead of the DER encoding
+	if (attribs[0].ulValueLen > 2 && value[0] == 0x04)
+	{
+		if (value[1] < 0x80)
+		{
+			ulHeaderLen = 2;
+			ulPointLen = value[1];
+		}
+		else if (value[1] == 0x81)
+		{
+			ulHeaderLen = 3;
+			ulPointLen = value[2];
+		}
+		if (ulHeaderLen + ulPointLen != attribs[0].ulValueLen)
+		{
+			ulHeaderLen = 0;
+		}
+	}
+
+	point.ulPointLen = attribs[0].ulValueLen - ulHeaderLen;
+	if (point.ulPointLen > EC_POINT_MAX_SIZE)
+	{
+		log_error("getEcPoint(): Invalid EC point\n");
+		return 1;
+	}
+	memcpy(point.point, value + ulHeaderLen, point.ulPointLen);
+
+	return 0;
+}
+
+// Benchmark ECDH key derivation
+int testDerive
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	unsigned int threads,
+	unsigned int iterations
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hPublicKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hPrivateKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hPeerPuk, hPeerPrk;
+	CK_ULONG objectsBefore = 0, objectsAfter = 0;
+
+	derive_arg_t* derive_arg_array;
+	ec_point_t point_pool[PEER_POOL_SIZE];
+	unsigned int n, bits = 0;
+	unsigned long derived = 0, destroyed = 0, firstCount = 0, lastCount = 0;
+	double speed, first = 0, last = 0;
+	histogram_t* histograms;
+
+	if (mechanism == NULL)
+	{
+		log_error("A mechanism must be supplied. "
+			  "Use --mechanism <mech>\n");
+		return 1;
+	}
+	if (strcmp(mechanism, "ECDH1_DERIVE") != 0)
+	{
+		log_error("Unknown derive mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+	if (keysize == NULL)
+	{
+		log_error("A key size must be supplied. "
+			  "Use --keysize <bits>\n");
+		return 1;
+	}
+	bits = atoi(keysize);
+	if (bits != 256 && bits != 384)
+	{
+		log_error("Invalid key size: "
+			  "%i [256, 384]\n", bits);
+		return 1;
+	}
+
+	if (openSession(slot, userPIN, hSessionRW))
+	{
+		return 1;
+	}
+
+	// The local key pair
+	if (generateEcdh(hSessionRW, bits, hPublicKey, hPrivateKey))
+	{
+		return 1;
+	}
+
+	// The public points of the peers, the peer keys are not needed anymore
+	for (n=0; n<PEER_POOL_SIZE; n++)
+	{
+		if (generateEcdh(hSessionRW, bits, hPeerPuk, hPeerPrk))
+		{
+			return 1;
+		}
+		if (getEcPoint(hSessionRW, hPeerPuk, point_pool[n]))
+		{
+			return 1;
+		}
+		p11->C_DestroyObject(hSessionRW, hPeerPuk);
+		p11->C_DestroyObject(hSessionRW, hPeerPrk);
+	}
+
+	// The derive histograms of the threads, followed by the destroy ones
+	histograms = (histogram_t*) malloc(sizeof(histogram_t) * threads * 2);
+	if (histograms == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+	derive_arg_array = (derive_arg_t*) allocThreadArgs(threads, sizeof(derive_arg_t));
+	if (derive_arg_array == NULL)
+	{
+		free(histograms);
+		return 1;
+	}
+
+	for (n=0; n<threads; n++)
+	{
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			free(derive_arg_array);
+			free(histograms);
+			return 1;
+		}
+
+		derive_arg_array[n].id = n;
+		derive_arg_array[n].iterations = iterations;
+		derive_arg_array[n].hSession = hSessionRO;
+		derive_arg_array[n].hPrivateKey = hPrivateKey;
+		derive_arg_array[n].points = point_pool;
+		derive_arg_array[n].pointCount = PEER_POOL_SIZE;
+		derive_arg_array[n].deriveHistogram = &histograms[n];
+		derive_arg_array[n].destroyHistogram = &histograms[threads + n];
+		derive_arg_array[n].firstTime = 0;
+		derive_arg_array[n].lastTime = 0;
+		derive_arg_array[n].firstCount = 0;
+		derive_arg_array[n].lastCount = 0;
+		derive_arg_array[n].derived = 0;
+		histogramReset(&histograms[n]);
+		histogramReset(&histograms[threads + n]);
+		derive_arg_array[n].destroyed = 0;
+	}
+
+	if (countObjects(hSessionRW, objectsBefore))
+	{
+		free(derive_arg_array);
+		free(histograms);
+		return 1;
+	}
+
+	log_notice("Deriving %d %s keys using %d %s...\n",
+		   iterations * threads, mechanism,
+		   threads, (threads > 1 ? "threads" : "thread"));
+
+	/* Create threads for key derivation */
+	if (runThreads(derive, derive_arg_array, sizeof(derive_arg_t),
+		       threads, 0, speed, NULL, NULL))
+	{
+		free(derive_arg_array);
+		free(histograms);
+		return 1;
+	}
+
+	if (countObjects(hSessionRW, objectsAfter))
+	{
+		free(derive_arg_array);
+		free(histograms);
+		return 1;
+	}
+
+	// Compare the first and the last tenth of each thread, a growing
+	// object table shows up as a slower derivation at the end of the run.
+	// Merge the latencies of the successful operations.
+	for (n=0; n<threads; n++)
+	{
+		first += derive_arg_array[n].firstTime;
+		last += derive_arg_array[n].lastTime;
+		firstCount += derive_arg_array[n].firstCount;
+		lastCount += derive_arg_array[n].lastCount;
+		derived += derive_arg_array[n].derived;
+		destroyed += derive_arg_array[n].destroyed;
+		if (n)
+		{
+			histogramMerge(&histograms[0], &histograms[n]);
+			histogramMerge(&histograms[threads], &histograms[threads + n]);
+		}
+	}
+	if (firstCount) first /= firstCount;
+	if (lastCount) last /= lastCount;
+
+	/* Report results */
+	printf("%d %s, %lu derivations, %.2f derive/s (%s %i bits)\n",
+	       threads, (threads > 1 ? "threads" : "thread"), derived,
+	       speed, mechanism, bits);
+	histogramPrint("Derive", &histograms[0]);
+	histogramPrint("Destroy", &histograms[threads]);
+	printf("Derive average: first 10%% %.2f ms, last 10%% %.2f ms\n",
+	       first * 1000, last * 1000);
+	printf("Objects: %lu before, %lu after, %lu derived keys not destroyed\n",
+	       objectsBefore, objectsAfter, derived - destroyed);
+
+	free(derive_arg_array);
+	free(histograms);
+
+	// Remove key
+	rv = p11->C_DestroyObject(hSessionRW, hPublicKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+	rv = p11->C_DestroyObject(hSessionRW, hPrivateKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return (derived == (unsigned long)threads * iterations &&
+		destroyed == derived ? 0 : 1);
+}
+
+// Translate the wrapping mechanism name and key size
+int getWrapMechanism
+(
+	char* mechanism,
+	char* keysize,
+	CK_MECHANISM_TYPE &mechanismType,
+	unsigned int &bits
+)
+{
+	if (mechanism == NULL)
+	{
+		log_error("A mechanism must be supplied. "
+			  "Use --mechanism <mech>\n");
+		return 1;
+	}
+
+	if (strcmp(mechanism, "AES_KEY_WRAP") == 0)
+	{
+		mechanismType = CKM_AES_KEY_WRAP;
+	}
+	else if (strcmp(mechanism, "AES_KEY_WRAP_PAD") == 0)
+	{
+		mechanismType = CKM_AES_KEY_WRAP_PAD;
+	}
+	else if (strcmp(mechanism, "RSA_PKCS_OAEP") == 0)
+	{
+		mechanismType = CKM_RSA_PKCS_OAEP;
+	}
+	else
+	{
+		log_error("Unknown wrapping mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+
+	if (keysize == NULL)
+	{
+		log_error("A key size must be supplied. "
+			  "Use --keysize <bits>\n");
+		return 1;
+	}
+
+	bits = atoi(keysize);
+	if (mechanismType == CKM_RSA_PKCS_OAEP)
+	{
+		if (bits < 1024 || bits > 4096)
+		{
+			log_error("Invalid key size: "
+				  "%i [1024-4096]\n", bits);
+			return 1;
+		}
+	}
+	else if (bits != 128 && bits != 192 && bits != 256)
+	{
+		log_error("Invalid key size: "
+			  "%i [128, 192, 256]\n", bits);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Benchmark key wrap and unwrap operations
+int testWrap
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	char* oaephash,
+	char* oaepmgf,
+	unsigned int threads,
+	unsigned int iterations,
+	int doWrap,
+	int doUnwrap
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_MECHANISM_TYPE mechanismType = CKM_VENDOR_DEFINED;
+	CK_OBJECT_HANDLE hWrappingKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hUnwrappingKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hTargets[WRAP_POOL_SIZE];
+	CK_RSA_PKCS_OAEP_PARAMS oaepParams;
+	CK_MECHANISM mech = { CKM_VENDOR_DEFINED, NULL_PTR, 0 };
+
+	wrap_arg_t* wrap_arg_array;
+	wrapped_t wrapped_pool[WRAP_POOL_SIZE];
+	unsigned int n, bits = 0;
+	double speed;
+	histogram_t* histograms;
+	int result = 0;
+	char details[64];
+
+	if (getWrapMechanism(mechanism, keysize, mechanismType, bits))
+	{
+		return 1;
+	}
+
+	mech.mechanism = mechanismType;
+	if (mechanismType == CKM_RSA_PKCS_OAEP)
+	{
+		if (getOaepParams(oaephash, oaepmgf, oaepParams))
+		{
+			return 1;
+		}
+		mech.pParameter = &oaepParams;
+		mech.ulParameterLen = sizeof(oaepParams);
+	}
+
+	if (openSession(slot, userPIN, hSessionRW))
+	{
+		return 1;
+	}
+
+	// The wrapping key
+	if (mechanismType == CKM_RSA_PKCS_OAEP)
+	{
+		result = generateRsa(hSessionRW, bits, hWrappingKey, hUnwrappingKey,
+				     KeyUsage::Wrap);
+	}
+	else
+	{
+		result = generateAes(hSessionRW, bits, hWrappingKey, KeyUsage::Wrap);
+		hUnwrappingKey = hWrappingKey;
+	}
+	if (result != 0)
+	{
+		return result;
+	}
+
+	// The keys that will be wrapped, and the pool of wrapped keys
+	// that will be unwrapped
+	for (n=0; n<WRAP_POOL_SIZE; n++)
+	{
+		if (generateAes(hSessionRW, WRAP_TARGET_SIZE, hTargets[n],
+				KeyUsage::Export))
+		{
+			return 1;
+		}
+
+		wrapped_pool[n].ulWrappedLen = sizeof(wrapped_pool[n].wrapped);
+		rv = p11->C_WrapKey(hSessionRW, &mech, hWrappingKey, hTargets[n],
+				    wrapped_pool[n].wrapped,
+				    &wrapped_pool[n].ulWrappedLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_WrapKey() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	wrap_arg_array = (wrap_arg_t*) allocThreadArgs(threads, sizeof(wrap_arg_t));
+	if (wrap_arg_array == NULL)
+	{
+		return 1;
+	}
+
+	// The unwrap histograms of the threads, followed by the destroy ones
+	histograms = (histogram_t*) malloc(sizeof(histogram_t) * threads * 2);
+	if (histograms == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		free(wrap_arg_array);
+		return 1;
+	}
+
+	for (n=0; n<threads; n++)
+	{
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			free(wrap_arg_array);
+			free(histograms);
+			return 1;
+		}
+
+		wrap_arg_array[n].id = n;
+		wrap_arg_array[n].iterations = iterations;
+		wrap_arg_array[n].hSession = hSessionRO;
+		wrap_arg_array[n].hWrappingKey = hWrappingKey;
+		wrap_arg_array[n].hUnwrappingKey = hUnwrappingKey;
+		wrap_arg_array[n].mechanism = &mech;
+		wrap_arg_array[n].targets = hTargets;
+		wrap_arg_array[n].wrapped = wrapped_pool;
+		wrap_arg_array[n].poolSize = WRAP_POOL_SIZE;
+		wrap_arg_array[n].unwrapHistogram = &histograms[n];
+		wrap_arg_array[n].destroyHistogram = &histograms[threads + n];
+		histogramReset(&histograms[n]);
+		histogramReset(&histograms[threads + n]);
+	}
+
+	snprintf(details, sizeof(details), "AES %i bit target keys",
+		 WRAP_TARGET_SIZE);
+
+	if (doWrap)
+	{
+		log_notice("Wrapping %d keys with %s using %d %s...\n",
+			   iterations * threads, mechanism,
+			   threads, (threads > 1 ? "threads" : "thread"));
+
+		/* Create threads for wrapping */
+		if (runThreads(wrap, wrap_arg_array, sizeof(wrap_arg_t),
+			       threads, 0, speed, NULL, NULL))
+		{
+			free(wrap_arg_array);
+			free(histograms);
+			return 1;
+		}
+
+		/* Report results */
+		printSignResult("wraps", "wrap/s", mechanism, bits, details,
+				threads, iterations, speed);
+	}
+
+	if (doUnwrap)
+	{
+		log_notice("Unwrapping %d keys with %s using %d %s...\n",
+			   iterations * threads, mechanism,
+			   threads, (threads > 1 ? "threads" : "thread"));
+
+		/* Create threads for unwrapping */
+		if (runThreads(unwrap, wrap_arg_array, sizeof(wrap_arg_t),
+			       threads, 0, speed, NULL, NULL))
+		{
+			free(wrap_arg_array);
+			free(histograms);
+			return 1;
+		}
+
+		for (n=1; n<threads; n++)
+		{
+			histogramMerge(&histograms[0], &histograms[n]);
+			histogramMerge(&histograms[threads], &histograms[threads + n]);
+		}
+
+		/* Report results */
+		printSignResult("unwraps", "unwrap+destroy/s", mechanism, bits,
+				details, threads, iterations, speed);
+		histogramPrint("Unwrap", &histograms[0]);
+		histogramPrint("Destroy", &histograms[threads]);
+	}
+
+	free(wrap_arg_array);
+	free(histograms);
+
+	// Remove keys
+	for (n=0; n<WRAP_POOL_SIZE; n++)
+	{
+		rv = p11->C_DestroyObject(hSessionRW, hTargets[n]);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+	rv = p11->C_DestroyObject(hSessionRW, hWrappingKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+	if (hUnwrappingKey != hWrappingKey)
+	{
+		rv = p11->C_DestroyObject(hSessionRW, hUnwrappingKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Benchmark the random number generator
+int testRandom
+(
+	unsigned int slot,
+	char* datasize,
+	unsigned int threads,
+	unsigned int iterations
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSession = CK_INVALID_HANDLE;
+
+	bulk_arg_t* bulk_arg_array;
+	CK_ULONG sizes[sizeof(bulk_sizes) / sizeof(bulk_sizes[0])];
+	CK_ULONG ulChunkSize;
+	unsigned int sizeCount;
+	char mechanism[] = "C_GenerateRandom";
+	int result;
+
+	if (getBulkSizes(datasize, NULL, sizes, sizeCount, ulChunkSize, 1))
+	{
+		return 1;
+	}
+
+	// The default sweep stops at the largest common request size
+	if (datasize == NULL)
+	{
+		while (sizeCount > 1 && sizes[sizeCount - 1] > RANDOM_MAX_SIZE)
+		{
+			sizeCount--;
+		}
+	}
+
+	// The random number generator does not need a login
+	rv = p11->C_OpenSession((CK_SLOT_ID)slot, CKF_SERIAL_SESSION,
+				NULL_PTR, NULL_PTR, &hSession);
+	if (rv != CKR_OK)
+	{
+		log_error("C_OpenSession() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	bulk_arg_array = (bulk_arg_t*) allocThreadArgs(threads, sizeof(bulk_arg_t));
+	if (bulk_arg_array == NULL)
+	{
+		return 1;
+	}
+
+	if (openBulkSessions(slot, bulk_arg_array, threads, iterations,
+			     CK_INVALID_HANDLE, NULL_PTR))
+	{
+		free(bulk_arg_array);
+		return 1;
+	}
+
+	// There is no multi-part variant of C_GenerateRandom
+	result = runBulkSweep(bulk_arg_array, hSession, threads, iterations,
+			      BulkOp::Random, sizes, sizeCount,
+			      0, mechanism, 0);
+	free(bulk_arg_array);
+
+	return result;
+}
+
+// Get the OAEP parameters for the hash and MGF names given on the command line
+int getOaepParams(char* oaephash, char* oaepmgf, CK_RSA_PKCS_OAEP_PARAMS &params)
+{
+	size_t i, count = sizeof(oaep_hashes) / sizeof(oaep_hashes[0]);
+
+	// SHA-1 is the default, it is supported by most tokens
+	if (oaephash == NULL) oaephash = (char*)"SHA1";
+	if (oaepmgf == NULL) oaepmgf = oaephash;
+
+	for (i=0; i<count; i++)
+	{
+		if (strcmp(oaephash, oaep_hashes[i].name) == 0) break;
+	}
+	if (i == count)
+	{
+		log_error("Unknown OAEP hash: %s [SHA1, SHA256, SHA384, SHA512]\n",
+			  oaephash);
+		return 1;
+	}
+	params.hashAlg = oaep_hashes[i].hashAlg;
+
+	for (i=0; i<count; i++)
+	{
+		if (strcmp(oaepmgf, oaep_hashes[i].name) == 0) break;
+	}
+	if (i == count)
+	{
+		log_error("Unknown OAEP MGF: %s [SHA1, SHA256, SHA384, SHA512]\n",
+			  oaepmgf);
+		return 1;
+	}
+	params.mgf = oaep_hashes[i].mgf;
+
+	params.source = CKZ_DATA_SPECIFIED;
+	params.pSourceData = NULL_PTR;
+	params.ulSourceDataLen = 0;
+
+	return 0;
+}
+
+// Benchmark RSA decryption
+int testRsaDecrypt
+(
+	unsigned int slot,
+	char* userPIN,
+	char* mechanism,
+	char* keysize,
+	char* oaephash,
+	char* oaepmgf,
+	unsigned int threads,
+	unsigned int iterations
+)
+{
+	CK_RV rv;
+	CK_SESSION_HANDLE hSessionRO = CK_INVALID_HANDLE;
+	CK_SESSION_HANDLE hSessionRW = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hPublicKey = CK_INVALID_HANDLE;
+	CK_OBJECT_HANDLE hPrivateKey = CK_INVALID_HANDLE;
+	CK_RSA_PKCS_OAEP_PARAMS oaepParams;
+	CK_MECHANISM mech = { CKM_VENDOR_DEFINED, NULL_PTR, 0 };
+	CK_BYTE plaintext[RSA_PLAINTEXT_SIZE];
+
+	rsa_decrypt_arg_t* decrypt_arg_array;
+	ciphertext_t ciphertext_pool[CIPHERTEXT_POOL_SIZE];
+	unsigned int n, bits = 0;
+	double speed;
+	char details[64];
+
+	if (strcmp(mechanism, "RSA_PKCS") == 0)
+	{
+		mech.mechanism = CKM_RSA_PKCS;
+		if (oaephash != NULL || oaepmgf != NULL)
+		{
+			log_error("The OAEP hash and MGF can only be used "
+				  "with RSA_PKCS_OAEP.\n");
+			return 1;
+		}
+	}
+	else if (strcmp(mechanism, "RSA_PKCS_OAEP") == 0)
+	{
+		mech.mechanism = CKM_RSA_PKCS_OAEP;
+		if (getOaepParams(oaephash, oaepmgf, oaepParams))
+		{
+			return 1;
+		}
+		mech.pParameter = &oaepParams;
+		mech.ulParameterLen = sizeof(oaepParams);
+	}
+	else
+	{
+		log_error("Unknown decryption mechanism. "
+			  "Please edit --mechanism <mech> to correct the error.\n");
+		return 1;
+	}
+
+	if (keysize == NULL)
+	{
+		log_error("A key size must be supplied. "
+			  "Use --keysize <bits>\n");
+		return 1;
+	}
+	bits = atoi(keysize);
+	if (bits < 1024 || bits > 4096)
+	{
+		log_error("Invalid key size: "
+			  "%i [1024-4096]\n", bits);
+		return 1;
+	}
+
+	if (openSession(slot, userPIN, hSessionRW))
+	{
+		return 1;
+	}
+
+	if (generateRsa(hSessionRW, bits, hPublicKey, hPrivateKey,
+			KeyUsage::Encrypt))
+	{
+		return 1;
+	}
+
+	// Encrypt a pool of different plaintexts with the public key
+	for (n=0; n<CIPHERTEXT_POOL_SIZE; n++)
+	{
+		memset(plaintext, n + 1, sizeof(plaintext));
+
+		rv = p11->C_EncryptInit(hSessionRW, &mech, hPublicKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_EncryptInit() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+
+		ciphertext_pool[n].ulCiphertextLen = sizeof(ciphertext_pool[n].ciphertext);
+		rv = p11->C_Encrypt(hSessionRW, plaintext, sizeof(plaintext),
+				    ciphertext_pool[n].ciphertext,
+				    &ciphertext_pool[n].ulCiphertextLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_Encrypt() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	decrypt_arg_array = (rsa_decrypt_arg_t*) allocThreadArgs(threads, sizeof(rsa_decrypt_arg_t));
+	if (decrypt_arg_array == NULL)
+	{
+		return 1;
+	}
+
+	for (n=0; n<threads; n++)
+	{
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSessionRO);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			free(decrypt_arg_array);
+			return 1;
+		}
+
+		decrypt_arg_array[n].id = n;
+		decrypt_arg_array[n].iterations = iterations;
+		decrypt_arg_array[n].hSession = hSessionRO;
+		decrypt_arg_array[n].hPrivateKey = hPrivateKey;
+		decrypt_arg_array[n].mechanism = &mech;
+		decrypt_arg_array[n].ciphertexts = ciphertext_pool;
+		decrypt_arg_array[n].ciphertextCount = CIPHERTEXT_POOL_SIZE;
+	}
+
+	log_notice("Decrypting %d %s ciphertexts using %d %s...\n",
+		   iterations * threads, mechanism,
+		   threads, (threads > 1 ? "threads" : "thread"));
+
+	/* Create threads for decryption */
+	if (runThreads(rsaDecrypt, decrypt_arg_array, sizeof(rsa_decrypt_arg_t),
+		       threads, 0, speed, NULL, NULL))
+	{
+		free(decrypt_arg_array);
+		return 1;
+	}
+	free(decrypt_arg_array);
+
+	/* Report results */
+	if (mech.mechanism == CKM_RSA_PKCS_OAEP)
+	{
+		snprintf(details, sizeof(details), "OAEP %s, MGF1 %s",
+			 (oaephash ? oaephash : "SHA1"),
+			 (oaepmgf ? oaepmgf : (oaephash ? oaephash : "SHA1")));
+	}
+	printSignResult("decryptions", "decrypt/s", mechanism, bits,
+			(mech.mechanism == CKM_RSA_PKCS_OAEP ? details : NULL),
+			threads, iterations, speed);
+
+	// Remove key
+	rv = p11->C_DestroyObject(hSessionRW, hPublicKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+	rv = p11->C_DestroyObject(hSessionRW, hPrivateKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateRsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk, KeyUsage::Type usage)
+{
+	CK_KEY_TYPE keyType = CKK_RSA;
+	CK_MECHANISM mechanism = {
+		CKM_RSA_PKCS_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+	CK_BYTE pubExp[] = { 0x01, 0x00, 0x01 };
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_BBOOL bSign = (usage == KeyUsage::Sign ? CK_TRUE : CK_FALSE);
+	CK_BBOOL bEncrypt = (usage == KeyUsage::Encrypt ? CK_TRUE : CK_FALSE);
+	CK_BBOOL bWrap = (usage == KeyUsage::Wrap ? CK_TRUE : CK_FALSE);
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_LABEL,           &label[0], sizeof(label)    },
+		{ CKA_ID,              &id[0],    sizeof(id)       },
+		{ CKA_KEY_TYPE,        &keyType,  sizeof(keyType)  },
+		{ CKA_VERIFY,          &bSign,    sizeof(bSign)    },
+		{ CKA_ENCRYPT,         &bEncrypt, sizeof(bEncrypt) },
+		{ CKA_WRAP,            &bWrap,    sizeof(bWrap)    },
+		{ CKA_TOKEN,           &bTrue,    sizeof(bTrue)    },
+		{ CKA_MODULUS_BITS,    &keysize,  sizeof(keysize)  },
+		{ CKA_PUBLIC_EXPONENT, &pubExp,   sizeof(pubExp)   }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)    },
+		{ CKA_ID,          &id[0],    sizeof(id)       },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType)  },
+		{ CKA_SIGN,        &bSign,    sizeof(bSign)    },
+		{ CKA_DECRYPT,     &bEncrypt, sizeof(bEncrypt) },
+		{ CKA_UNWRAP,      &bWrap,    sizeof(bWrap)    },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)    },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)    },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)    },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)   }
+	};
+
+	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
+					  pukAttribs, 9,
+					  prkAttribs, 10,
+					  &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateDsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+{
+	CK_KEY_TYPE keyType = CKK_DSA;
+	CK_MECHANISM mechanism1 = {
+		CKM_DSA_PARAMETER_GEN, NULL_PTR, 0
+	};
+	CK_MECHANISM mechanism2 = {
+		CKM_DSA_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_BYTE dsa_p[512];
+	CK_BYTE dsa_q[32];
+	CK_BYTE dsa_g[512];
+
+	CK_ATTRIBUTE domainTemplate[] = {
+		{ CKA_PRIME_BITS, &keysize, sizeof(keysize) }
+	};
+	CK_OBJECT_HANDLE domainPar;
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_PRIME,    dsa_p,     sizeof(dsa_p)   },
+		{ CKA_SUBPRIME, dsa_q,     sizeof(dsa_q)   },
+		{ CKA_BASE,     dsa_g,     sizeof(dsa_g)   },
+		{ CKA_LABEL,    &label[0], sizeof(label)   },
+		{ CKA_ID,       &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE, &keyType,  sizeof(keyType) },
+		{ CKA_VERIFY,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_ENCRYPT,  &bFalse,   sizeof(bFalse)  },
+		{ CKA_WRAP,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_TOKEN,    &bTrue,    sizeof(bTrue)   }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
+		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	CK_RV rv = p11->C_GenerateKey(hSession, &mechanism1,
+				      domainTemplate, 1,
+				      &domainPar);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKey() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	rv = p11->C_GetAttributeValue(hSession, domainPar,
+				      pukAttribs, 3);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GetAttributeValue() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	rv = p11->C_DestroyObject(hSession, domainPar);
+	if (rv != CKR_OK)
+	{
+		log_error("C_DestroyObject() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	rv = p11->C_GenerateKeyPair(hSession, &mechanism2,
+				    pukAttribs, 10,
+				    prkAttribs, 10,
+				    &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateEcdsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+{
+	CK_KEY_TYPE keyType = CKK_EC;
+	CK_MECHANISM mechanism = {
+		CKM_EC_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+	CK_BYTE oidP256[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07 };
+	CK_BYTE oidP384[] = { 0x06, 0x05, 0x2B, 0x81, 0x04, 0x00, 0x22 };
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_EC_PARAMS, NULL,      0               },
+		{ CKA_LABEL,     &label[0], sizeof(label)   },
+		{ CKA_ID,        &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,  &keyType,  sizeof(keyType) },
+		{ CKA_VERIFY,    &bTrue,    sizeof(bTrue)   },
+		{ CKA_ENCRYPT,   &bFalse,   sizeof(bFalse)  },
+		{ CKA_WRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_TOKEN,     &bTrue,    sizeof(bTrue)   }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
+		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	// Select the curve
+	if (keysize == 256)
+	{
+		pukAttribs[0].pValue = oidP256;
+		pukAttribs[0].ulValueLen = sizeof(oidP256);
+	}
+	else if (keysize == 384)
+	{
+		pukAttribs[0].pValue = oidP384;
+		pukAttribs[0].ulValueLen = sizeof(oidP384);
+	}
+	else
+	{
+		log_error("generateEcdsa(): Invalid curve\n");
+		return 1;
+	}
+
+	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
+					  pukAttribs, 8,
+					  prkAttribs, 10,
+					  &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateEddsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+{
+	CK_KEY_TYPE keyType = CKK_EC_EDWARDS;
+	CK_MECHANISM mechanism = {
+		CKM_EC_EDWARDS_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+	CK_BYTE oidEd25519[] = { 0x06, 0x03, 0x2B, 0x65, 0x70 };
+	CK_BYTE oidEd448[] = { 0x06, 0x03, 0x2B, 0x65, 0x71 };
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_EC_PARAMS, NULL,      0               },
+		{ CKA_LABEL,     &label[0], sizeof(label)   },
+		{ CKA_ID,        &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,  &keyType,  sizeof(keyType) },
+		{ CKA_VERIFY,    &bTrue,    sizeof(bTrue)   },
+		{ CKA_ENCRYPT,   &bFalse,   sizeof(bFalse)  },
+		{ CKA_WRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_TOKEN,     &bTrue,    sizeof(bTrue)   }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
+		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	// Select the curve, Ed25519 (curve25519) or Ed448 (curve448)
+	if (keysize == 255)
+	{
+		pukAttribs[0].pValue = oidEd25519;
+		pukAttribs[0].ulValueLen = sizeof(oidEd25519);
+	}
+	else if (keysize == 448)
+	{
+		pukAttribs[0].pValue = oidEd448;
+		pukAttribs[0].ulValueLen = sizeof(oidEd448);
+	}
+	else
+	{
+		log_error("generateEddsa(): Invalid curve\n");
+		return 1;
+	}
+
+	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
+					  pukAttribs, 8,
+					  prkAttribs, 10,
+					  &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+// The ECDH key pairs are session objects, they are only used by the benchmark
+int generateEcdh(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+{
+	CK_KEY_TYPE keyType = CKK_EC;
+	CK_MECHANISM mechanism = {
+		CKM_EC_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+	CK_BYTE oidP256[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07 };
+	CK_BYTE oidP384[] = { 0x06, 0x05, 0x2B, 0x81, 0x04, 0x00, 0x22 };
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_EC_PARAMS, NULL,      0               },
+		{ CKA_LABEL,     &label[0], sizeof(label)   },
+		{ CKA_ID,        &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,  &keyType,  sizeof(keyType) },
+		{ CKA_VERIFY,    &bFalse,   sizeof(bFalse)  },
+		{ CKA_ENCRYPT,   &bFalse,   sizeof(bFalse)  },
+		{ CKA_WRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_TOKEN,     &bFalse,   sizeof(bFalse)  }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_SIGN,        &bFalse,   sizeof(bFalse)  },
+		{ CKA_DERIVE,      &bTrue,    sizeof(bTrue)   },
+		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bFalse,   sizeof(bFalse)  },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	// Select the curve
+	if (keysize == 256)
+	{
+		pukAttribs[0].pValue = oidP256;
+		pukAttribs[0].ulValueLen = sizeof(oidP256);
+	}
+	else if (keysize == 384)
+	{
+		pukAttribs[0].pValue = oidP384;
+		pukAttribs[0].ulValueLen = sizeof(oidP384);
+	}
+	else
+	{
+		log_error("generateEcdh(): Invalid curve\n");
+		return 1;
+	}
+
+	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
+					  pukAttribs, 8,
+					  prkAttribs, 11,
+					  &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateGost(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+{
+	CK_KEY_TYPE keyType = CKK_GOSTR3410;
+	CK_MECHANISM mechanism = {
+		CKM_GOSTR3410_KEY_PAIR_GEN, NULL_PTR, 0
+	};
+	CK_BYTE oid1[] = { 0x06, 0x07, 0x2A, 0x85, 0x03, 0x02, 0x02, 0x23, 0x01 };
+	CK_BYTE oid2[] = { 0x06, 0x07, 0x2A, 0x85, 0x03, 0x02, 0x02, 0x1E, 0x01 };
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_ATTRIBUTE pukAttribs[] = {
+		{ CKA_GOSTR3410_PARAMS, oid1,      sizeof(oid1)    },
+		{ CKA_GOSTR3411_PARAMS, oid2,      sizeof(oid2)    },
+		{ CKA_LABEL,            &label[0], sizeof(label)   },
+		{ CKA_ID,               &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,         &keyType,  sizeof(keyType) },
+		{ CKA_VERIFY,           &bTrue,    sizeof(bTrue)   },
+		{ CKA_ENCRYPT,          &bFalse,   sizeof(bFalse)  },
+		{ CKA_WRAP,             &bFalse,   sizeof(bFalse)  },
+		{ CKA_TOKEN,            &bTrue,    sizeof(bTrue)   }
+	};
+
+	CK_ATTRIBUTE prkAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
+		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
+		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
+					  pukAttribs, 9,
+					  prkAttribs, 10,
+					  &hPuk, &hPrk);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateAes(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hKey, KeyUsage::Type usage)
+{
+	CK_KEY_TYPE keyType = CKK_AES;
+	CK_MECHANISM mechanism = {
+		CKM_AES_KEY_GEN, NULL_PTR, 0
+	};
+	CK_ULONG bytes = keysize / 8;
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_BBOOL bEncrypt = (usage != KeyUsage::Wrap ? CK_TRUE : CK_FALSE);
+	CK_BBOOL bWrap = (usage == KeyUsage::Wrap ? CK_TRUE : CK_FALSE);
+	CK_BBOOL bExport = (usage == KeyUsage::Export ? CK_TRUE : CK_FALSE);
+
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)    },
+		{ CKA_ID,          &id[0],    sizeof(id)       },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType)  },
+		{ CKA_VALUE_LEN,   &bytes,    sizeof(bytes)    },
+		{ CKA_ENCRYPT,     &bEncrypt, sizeof(bEncrypt) },
+		{ CKA_DECRYPT,     &bEncrypt, sizeof(bEncrypt) },
+		{ CKA_WRAP,        &bWrap,    sizeof(bWrap)    },
+		{ CKA_UNWRAP,      &bWrap,    sizeof(bWrap)    },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)    },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)    },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)    },
+		{ CKA_EXTRACTABLE, &bExport,  sizeof(bExport)  }
+	};
+
+	CK_RV rv = p11->C_GenerateKey(hSession, &mechanism,
+				      keyAttribs, 12,
+				      &hKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKey() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+int generateGenericSecret(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hKey)
+{
+	CK_KEY_TYPE keyType = CKK_GENERIC_SECRET;
+	CK_MECHANISM mechanism = {
+		CKM_GENERIC_SECRET_KEY_GEN, NULL_PTR, 0
+	};
+	CK_ULONG bytes = keysize / 8;
+	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
+	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_LABEL,       &label[0], sizeof(label)   },
+		{ CKA_ID,          &id[0],    sizeof(id)      },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
+		{ CKA_VALUE_LEN,   &bytes,    sizeof(bytes)   },
+		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
+		{ CKA_VERIFY,      &bTrue,    sizeof(bTrue)   },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
+		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
+		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
+	};
+
+	CK_RV rv = p11->C_GenerateKey(hSession, &mechanism,
+				      keyAttribs, 10,
+				      &hKey);
+	if (rv != CKR_OK)
+	{
+		log_error("C_GenerateKey() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Sign the data of the thread, the operation must be initialized
+int signData(sign_arg_t* sign_arg)
+{
+	CK_SESSION_HANDLE hSession = sign_arg->hSession;
+	CK_BYTE_PTR data = sign_arg->data;
+	CK_ULONG ulDataLen = sign_arg->ulDataLen;
+	CK_ULONG ulChunkSize = sign_arg->ulChunkSize;
+
+	CK_RV rv;
+	CK_ULONG ulOffset, ulLen;
+
+	// 4096 / 8 = 512
+	CK_BYTE signature[512];
+	CK_ULONG ulSignatureLen = sizeof(signature);
+
+	if (ulChunkSize == 0)
+	{
+		rv = sign_arg->p11->C_Sign(hSession,
+				 data,
+				 ulDataLen,
+				 signature,
+				 &ulSignatureLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_Sign() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	for (ulOffset=0; ulOffset<ulDataLen; ulOffset+=ulLen)
+	{
+		ulLen = ulDataLen - ulOffset;
+		if (ulLen > ulChunkSize) ulLen = ulChunkSize;
+
+		rv = sign_arg->p11->C_SignUpdate(hSession, data + ulOffset, ulLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_SignUpdate() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	rv = sign_arg->p11->C_SignFinal(hSession, signature, &ulSignatureLen);
+	if (rv != CKR_OK)
+	{
+		log_error("C_SignFinal() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Verify the signature of the data, the operation must be initialized
+int verifyData(sign_arg_t* sign_arg, signature_t* signature)
+{
+	CK_SESSION_HANDLE hSession = sign_arg->hSession;
+	CK_BYTE_PTR data = sign_arg->data;
+	CK_ULONG ulDataLen = sign_arg->ulDataLen;
+	CK_ULONG ulChunkSize = sign_arg->ulChunkSize;
+
+	CK_RV rv;
+	CK_ULONG ulOffset, ulLen;
+
+	if (ulChunkSize == 0)
+	{
+		rv = sign_arg->p11->C_Verify(hSession,
+				   data,
+				   ulDataLen,
+				   signature->signature,
+				   signature->ulSignatureLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_Verify() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	for (ulOffset=0; ulOffset<ulDataLen; ulOffset+=ulLen)
+	{
+		ulLen = ulDataLen - ulOffset;
+		if (ulLen > ulChunkSize) ulLen = ulChunkSize;
+
+		rv = sign_arg->p11->C_VerifyUpdate(hSession, data + ulOffset, ulLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_VerifyUpdate() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+	}
+
+	rv = sign_arg->p11->C_VerifyFinal(hSession,
+				signature->signature,
+				signature->ulSignatureLen);
+	if (rv != CKR_OK)
+	{
+		log_error("C_VerifyFinal() returned error: rv=%X\n",
+			  (unsigned int)rv);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Wait until the intended start time of the next operation in open-loop
+// mode. Returns the time from which the latency is measured.
+double waitForSchedule(sign_arg_t* sign_arg, size_t i)
+{
+	double intended;
+
+	if (sign_arg->interval == 0) return getTime();
+
+	// The threads take turns on one timetable
+	intended = sign_arg->start + sign_arg->offset + i * sign_arg->interval;
+
+	// A thread that is late starts directly, the delay ends up in the latency
+	if (intended > getTime()) sleepUntil(intended);
+
+	return intended;
+}
+
+// Count and record the operation if it completed in the measured window.
+// Returns non-zero when the deadline has passed.
+int countInWindow(sign_arg_t* sign_arg, double started, double initStarted, double initDone)
+{
+	double now = getTime();
+
+	// Without a deadline, all the iterations are counted
+	if (sign_arg->deadline > 0)
+	{
+		if (now >= sign_arg->deadline) return 1;
+		if (now < sign_arg->warmupEnd) return 0;
+	}
+
+	sign_arg->counted++;
+	if (sign_arg->histogramShared)
+	{
+		histogramRecordShared(sign_arg->histogram, now - started);
+		histogramRecordShared(sign_arg->initHistogram, initDone - initStarted);
+		histogramRecordShared(sign_arg->callHistogram, now - initDone);
+	}
+	else
+	{
+		histogramRecord(sign_arg->histogram, now - started);
+		histogramRecord(sign_arg->initHistogram, initDone - initStarted);
+		histogramRecord(sign_arg->callHistogram, now - initDone);
+	}
+	sign_arg->initTime += initDone - initStarted;
+	sign_arg->callTime += now - initDone;
+	if (sign_arg->slotCount > 1)
+	{
+		__sync_fetch_and_add(&sign_arg->slots[sign_arg->slotIndex].counted, 1);
+	}
+
+	return 0;
+}
+
+// Open the sessions that are shared by the threads
+int openSessionPool(unsigned int slot, unsigned int sessions, session_pool_t &pool)
+{
+	CK_RV rv;
+	unsigned int n;
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pool.waiters = 0;
+	pool.inFlight = 0;
+
+	pool.sessions = (CK_SESSION_HANDLE*) malloc(sizeof(CK_SESSION_HANDLE) * sessions);
+	pool.busy = (volatile int*) calloc(sessions, sizeof(int));
+	if (pool.sessions == NULL || pool.busy == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+
+	for (n=0; n<sessions; n++)
+	{
+		rv = p11->C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR,
+					&pool.sessions[n]);
+		if (rv != CKR_OK)
+		{
+			log_error("C_OpenSession() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			return 1;
+		}
+		pool.count++;
+	}
+
+	return 0;
+}
+
+void freeSessionPool(session_pool_t &pool)
+{
+	// The pool was never opened
+	if (pool.sessions == NULL && pool.busy == NULL) return;
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	free(pool.sessions);
+	free((void*)pool.busy);
+	pool.sessions = NULL;
+	pool.busy = NULL;
+	pool.count = 0;
+}
+
+// Take a free session from the pool, looking from the one after the
+// previous session of the thread. The busy flag of a session is set with
+// a compare-and-swap, so no lock is needed.
+int takeSession(sign_arg_t* sign_arg, session_pool_t* pool)
+{
+	unsigned int n, index;
+
+	for (n=0; n<pool->count; n++)
+	{
+		index = (sign_arg->poolCursor + n) % pool->count;
+		if (!pool->busy[index] &&
+		    __sync_bool_compare_and_swap(&pool->busy[index], 0, 1))
+		{
+			sign_arg->pool = pool;
+			sign_arg->poolIndex = index;
+			sign_arg->poolCursor = index + 1;
+			sign_arg->hSession = pool->sessions[index];
+			__sync_add_and_fetch(&pool->inFlight, 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// The slot with the fewest operations in flight, looking from the home
+// slot of the thread, so that the home slot wins a tie
+unsigned int leastBusySlot(sign_arg_t* sign_arg)
+{
+	unsigned int n, index, least = sign_arg->home;
+
+	for (n=1; n<sign_arg->slotCount; n++)
+	{
+		index = (sign_arg->home + n) % sign_arg->slotCount;
+		if (sign_arg->slots[index].pool.inFlight <
+		    sign_arg->slots[least].pool.inFlight)
+		{
+			least = index;
+		}
+	}
+
+	return least;
+}
+
+// Take a session for the next operation. With a list of slots and
+// iterations, the operation also comes from the queue of the slot. A thread
+// tries its home slot first, and steals work from another slot when its home
+// slot has no work left or no free session. With a duration the work is
+// unlimited, and every operation goes to the slot with the fewest operations
+// in flight. A slow slot holds its sessions longer, so the fast slots get
+// more of the work.
+// Returns non-zero when no slot has any work left.
+int checkoutSession(sign_arg_t* sign_arg)
+{
+	sign_slot_t* signSlot;
+	unsigned int n, index, first, spins = 0;
+	int waited = 0, queued;
+	int useQueue = (sign_arg->slotCount > 1 && sign_arg->deadline == 0);
+
+	if (sign_arg->homePool == NULL) return 0;
+
+	sign_arg->poolCheckouts++;
+	for (;;)
+	{
+		queued = 0;
+		first = sign_arg->home;
+		if (!useQueue && sign_arg->slotCount > 1)
+		{
+			first = leastBusySlot(sign_arg);
+		}
+		for (n=0; n<sign_arg->slotCount; n++)
+		{
+			index = (first + n) % sign_arg->slotCount;
+			signSlot = &sign_arg->slots[index];
+
+			if (useQueue)
+			{
+				if (signSlot->remaining <= 0) continue;
+				queued = 1;
+			}
+			if (!takeSession(sign_arg, &signSlot->pool)) continue;
+
+			// Another thread may have taken the last operation
+			if (useQueue &&
+			    __sync_fetch_and_sub(&signSlot->remaining, 1) <= 0)
+			{
+				releaseSession(sign_arg);
+				continue;
+			}
+
+			sign_arg->slotIndex = index;
+			sign_arg->keys = &signSlot->keys;
+			sign_arg->signatures = signSlot->signatures;
+			sign_arg->signatureCount = signSlot->signatureCount;
+			if (index != sign_arg->home) sign_arg->stolen++;
+			return 0;
+		}
+
+		if (useQueue && !queued) return 1;
+
+		// All sessions are in use. Spinning threads would take the CPU
+		// from the threads that hold a session, so they soon block.
+		if (!waited)
+		{
+			sign_arg->poolWaits++;
+			waited = 1;
+		}
+		if (spins < SESSION_POOL_SPINS)
+		{
+			spins++;
+			sched_yield();
+		}
+		else
+		{
+			waitForSession(sign_arg->homePool);
+		}
+	}
+}
+
+// Block until a session of the pool is returned. The wait is bounded, so
+// that a thread with a list of slots also looks at the other slots.
+void waitForSession(session_pool_t* pool)
+{
+	struct timespec deadline;
+	unsigned int n;
+	int busy = 1;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->waiters++;
+	__sync_synchronize();
+
+	// A session may have been returned before the waiter was counted
+	for (n=0; n<pool->count && busy; n++)
+	{
+		if (!pool->busy[n]) busy = 0;
+	}
+	if (busy)
+	{
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += SESSION_POOL_WAIT_NS;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline);
+	}
+
+	pool->waiters--;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void releaseSession(sign_arg_t* sign_arg)
+{
+	session_pool_t* pool = sign_arg->pool;
+
+	if (sign_arg->homePool == NULL) return;
+
+	__sync_sub_and_fetch(&pool->inFlight, 1);
+	__sync_lock_release(&pool->busy[sign_arg->poolIndex]);
+
+	// Wake a thread that waits for a session
+	__sync_synchronize();
+	if (pool->waiters)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+// Report how often the threads had to wait for a session
+void printSessionPool(sign_arg_t* sign_arg_array, unsigned int threads)
+{
+	unsigned long checkouts = 0, waits = 0;
+	unsigned int n;
+
+	for (n=0; n<threads; n++)
+	{
+		checkouts += sign_arg_array[n].poolCheckouts;
+		waits += sign_arg_array[n].poolWaits;
+	}
+
+	printf("Session pool: %u %s%s for %u %s, %.2f%% of the checkouts "
+	       "waited for a free session\n",
+	       sign_arg_array[0].homePool->count,
+	       (sign_arg_array[0].homePool->count > 1 ? "sessions" : "session"),
+	       (sign_arg_array[0].slotCount > 1 ? " per slot" : ""),
+	       threads, (threads > 1 ? "threads" : "thread"),
+	       (checkouts ? 100.0 * waits / checkouts : 0));
+}
+
+// Report the latency of the init call and the other calls on their own,
+// and how much of the time of an operation goes to the init call
+void printInitShare
+(
+	sign_arg_t* sign_arg_array,
+	unsigned int threads,
+	const char* label,
+	histogram_t* initHistogram,
+	histogram_t* callHistogram
+)
+{
+	char initLabel[32], callLabel[32];
+	double initTime = 0, callTime = 0;
+	unsigned int n;
+
+	if (initHistogram->count == 0) return;
+
+	for (n=0; n<threads; n++)
+	{
+		initTime += sign_arg_array[n].initTime;
+		callTime += sign_arg_array[n].callTime;
+	}
+
+	snprintf(initLabel, sizeof(initLabel), "C_%sInit", label);
+	snprintf(callLabel, sizeof(callLabel),
+		 (sign_arg_array[0].ulChunkSize ? "C_%sUpdate/Final" : "C_%s"), label);
+	histogramPrint(initLabel, initHistogram);
+	histogramPrint(callLabel, callHistogram);
+	printf("%s takes %.2f%% of the time per operation, %.3f ms of %.3f ms "
+	       "on average\n", initLabel,
+	       (initTime + callTime > 0 ? 100 * initTime / (initTime + callTime) : 0),
+	       initTime * 1000 / initHistogram->count,
+	       (initTime + callTime) * 1000 / initHistogram->count);
+}
+
+// Report the share of the operations done by each slot, for the modules
+// that use more than one slot
+void printSignSlots
+(
+	sign_arg_t* sign_arg_array,
+	unsigned int threads,
+	const char* operation,
+	const char* unit,
+	double elapsed
+)
+{
+	unsigned int moduleCount = sign_arg_array[0].moduleCount;
+	sign_slot_t* signSlots;
+	unsigned long counted, stolen, checkouts;
+	unsigned int n, m, slotCount;
+
+	for (m=0; m<moduleCount && m<threads; m++)
+	{
+		signSlots = sign_arg_array[m].slots;
+		slotCount = sign_arg_array[m].slotCount;
+		if (slotCount < 2) continue;
+
+		counted = stolen = checkouts = 0;
+		for (n=0; n<slotCount; n++)
+		{
+			counted += signSlots[n].counted;
+		}
+		for (n=m; n<threads; n+=moduleCount)
+		{
+			stolen += sign_arg_array[n].stolen;
+			checkouts += sign_arg_array[n].poolCheckouts;
+		}
+
+		for (n=0; n<slotCount; n++)
+		{
+			printf("Slot %lu", signSlots[n].slotID);
+			if (moduleCount > 1)
+			{
+				printf(" of %s", getModuleName(&sign_arg_array[m].modules[m]));
+			}
+			printf(": %lu %s, %.2f %s (%.2f%%)\n",
+			       signSlots[n].counted, operation,
+			       signSlots[n].counted / elapsed, unit,
+			       (counted ? 100.0 * signSlots[n].counted / counted : 0));
+		}
+		printf("%.2f%% of the %s were stolen from another slot\n",
+		       (checkouts ? 100.0 * stolen / checkouts : 0), operation);
+	}
+}
+
+// Report the share of the operations done by each module
+void printSignModules
+(
+	sign_arg_t* sign_arg_array,
+	unsigned int threads,
+	const char* operation,
+	const char* unit,
+	double elapsed
+)
+{
+	unsigned int moduleCount = sign_arg_array[0].moduleCount;
+	unsigned long total = 0, counted;
+	unsigned int n, m;
+
+	if (moduleCount < 2) return;
+
+	for (n=0; n<threads; n++)
+	{
+		total += sign_arg_array[n].counted;
+	}
+
+	for (m=0; m<moduleCount; m++)
+	{
+		counted = 0;
+		for (n=m; n<threads; n+=moduleCount)
+		{
+			counted += sign_arg_array[n].counted;
+		}
+
+		printf("Module %s: %u %s, %lu %s, %.2f %s (%.2f%%)\n",
+		       getModuleName(&sign_arg_array[0].modules[m]),
+		       threads / moduleCount,
+		       (threads / moduleCount > 1 ? "threads" : "thread"),
+		       counted, operation, counted / elapsed, unit,
+		       (total ? 100.0 * counted / total : 0));
+	}
+}
+
+// The path of the module, or the default library
+const char* getModuleName(module_t* module)
+{
+	return (module->path ? module->path : DEFAULT_PKCS11_LIB);
+}
+
+void* sign (void* arg)
+{
+	sign_arg_t* sign_arg = (sign_arg_t*)arg;
+	unsigned int iterations = sign_arg->iterations;
+	CK_MECHANISM_PTR mechanism = sign_arg->mechanism;
+
+	size_t i;
+	CK_RV rv;
+	CK_OBJECT_HANDLE hPrivateKey;
+	double started, initStarted, initDone;
+	int result;
+
+	/* Do some signing, until the iterations or the time has run out */
+	for (i=0; sign_arg->deadline > 0 || sign_arg->slotCount > 1 || i<iterations; i++) {
+		started = waitForSchedule(sign_arg, i);
+
+		// The session also selects the slot and its keys
+		if (checkoutSession(sign_arg)) break;
+		hPrivateKey = sign_arg->keys->hPrivateKeys[selectKey(sign_arg)];
+
+		// The init call and the sign calls are timed on their own
+		initStarted = getTime();
+		rv = sign_arg->p11->C_SignInit(sign_arg->hSession, mechanism, hPrivateKey);
+		initDone = getTime();
+		if (rv != CKR_OK)
+		{
+			releaseSession(sign_arg);
+			log_error("C_SignInit() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			sign_arg->failed = 1;
+			break;
+		}
+
+		result = signData(sign_arg);
+		releaseSession(sign_arg);
+		if (result)
+		{
+			sign_arg->failed = 1;
+			break;
+		}
+		countOperation();
+		if (countInWindow(sign_arg, started, initStarted, initDone)) break;
+	}
+
+	pthread_exit(NULL);
+}
+
+void* verify (void* arg)
+{
+	sign_arg_t* sign_arg = (sign_arg_t*)arg;
+	unsigned int id = sign_arg->id;
+	unsigned int iterations = sign_arg->iterations;
+	CK_MECHANISM_PTR mechanism = sign_arg->mechanism;
+
+	size_t i;
+	CK_RV rv;
+	double started, initStarted, initDone;
+	int result;
+	unsigned int key, keyCount;
+
+	/* Do some verifying, walk through the signature pool */
+	for (i=0; sign_arg->deadline > 0 || sign_arg->slotCount > 1 || i<iterations; i++) {
+		started = waitForSchedule(sign_arg, i);
+
+		// The session also selects the slot, its keys and signatures
+		if (checkoutSession(sign_arg)) break;
+		key = selectKey(sign_arg);
+		keyCount = sign_arg->keys->count;
+		initStarted = getTime();
+		rv = sign_arg->p11->C_VerifyInit(sign_arg->hSession, mechanism,
+				       sign_arg->keys->hPublicKeys[key]);
+		initDone = getTime();
+		if (rv != CKR_OK)
+		{
+			releaseSession(sign_arg);
+			log_error("C_VerifyInit() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			sign_arg->failed = 1;
+			break;
+		}
+
+		// A signature made with the key, walking through the pool
+		result = verifyData(sign_arg, &sign_arg->signatures[key + keyCount *
+				    ((id + i) % (sign_arg->signatureCount / keyCount))]);
+		releaseSession(sign_arg);
+		if (result)
+		{
+			sign_arg->failed = 1;
+			break;
+		}
+		countOperation();
+		if (countInWindow(sign_arg, started, initStarted, initDone)) break;
+	}
+
+	pthread_exit(NULL);
+}
+
+// Write a GCM IV of a 32 bit prefix and a 64 bit counter
+void setGcmIv(CK_BYTE_PTR iv, unsigned int prefix, unsigned long counter)
+{
+	unsigned int n;
+
+	for (n=0; n<4; n++)
+	{
+		iv[n] = (CK_BYTE)(prefix >> (24 - 8 * n));
+	}
+	for (n=0; n<8; n++)
+	{
+		iv[4 + n] = (CK_BYTE)((unsigned long long)counter >> (56 - 8 * n));
+	}
+}
+
+// The mechanism for the next AES-GCM encryption of the thread. An IV must
+// not be used twice with the same key, so each thread counts with its own
+// prefix. The prefix 0 is left for the cipher texts of the decryption.
+CK_MECHANISM_PTR nextGcmIv(bulk_arg_t* bulk_arg)
+{
+	bulk_arg->gcmParams = *(CK_GCM_PARAMS*)bulk_arg->mechanism->pParameter;
+	bulk_arg->gcmParams.pIv = bulk_arg->gcmIv;
+	setGcmIv(bulk_arg->gcmIv, bulk_arg->id + 1, bulk_arg->gcmCounter++);
+
+	bulk_arg->gcmMechanism = *bulk_arg->mechanism;
+	bulk_arg->gcmMechanism.pParameter = &bulk_arg->gcmParams;
+
+	return &bulk_arg->gcmMechanism;
+}
+
+// Explain an AES-GCM encryption that fails on the IV
+void logGcmIvError(CK_MECHANISM_PTR mechanism, CK_RV rv)
+{
+	if (mechanism->mechanism != CKM_AES_GCM ||
+	    rv != CKR_MECHANISM_PARAM_INVALID)
+	{
+		return;
+	}
 
-	CK_ATTRIBUTE pukAttribs[] = {
-		{ CKA_EC_PARAMS, NULL,      0               },
-		{ CKA_LABEL,     &label[0], sizeof(label)   },
-		{ CKA_ID,        &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,  &keyType,  sizeof(keyType) },
-		{ CKA_VERIFY,    &bTrue,    sizeof(bTrue)   },
-		{ CKA_ENCRYPT,   &bFalse,   sizeof(bFalse)  },
-		{ CKA_WRAP,      &bFalse,   sizeof(bFalse)  },
-		{ CKA_TOKEN,     &bTrue,    sizeof(bTrue)   }
-	};
+	log_error("The token does not accept an IV from the caller for AES_GCM "
+		  "encryption. A token in FIPS mode generates the IV itself, "
+		  "which is not supported by this benchmark.\n");
+}
 
-	CK_ATTRIBUTE prkAttribs[] = {
-		{ CKA_LABEL,       &label[0], sizeof(label)   },
-		{ CKA_ID,          &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
-		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
-		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
-		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
-		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
-		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
-		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
-		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
-	};
+CK_RV bulkInit(bulk_arg_t* bulk_arg)
+{
+	switch (bulk_arg->operation)
+	{
+		case BulkOp::Encrypt:
+			if (bulk_arg->mechanism->mechanism == CKM_AES_GCM)
+			{
+				return p11->C_EncryptInit(bulk_arg->hSession,
+							  nextGcmIv(bulk_arg),
+							  bulk_arg->hKey);
+			}
+			return p11->C_EncryptInit(bulk_arg->hSession,
+						  bulk_arg->mechanism,
+						  bulk_arg->hKey);
+		case BulkOp::Decrypt:
+			return p11->C_DecryptInit(bulk_arg->hSession,
+						  bulk_arg->mechanism,
+						  bulk_arg->hKey);
+		case BulkOp::Digest:
+			return p11->C_DigestInit(bulk_arg->hSession,
+						 bulk_arg->mechanism);
+		case BulkOp::Mac:
+			return p11->C_SignInit(bulk_arg->hSession,
+					       bulk_arg->mechanism,
+					       bulk_arg->hKey);
+		case BulkOp::Random:
+			// No initialization
+			return CKR_OK;
+		default:
+			return CKR_FUNCTION_NOT_SUPPORTED;
+	}
+}
 
-	// Select the curve
-	if (keysize == 256)
+CK_RV bulkSingle(bulk_arg_t* bulk_arg, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen)
+{
+	switch (bulk_arg->operation)
 	{
-		pukAttribs[0].pValue = oidP256;
-		pukAttribs[0].ulValueLen = sizeof(oidP256);
+		case BulkOp::Encrypt:
+			return p11->C_Encrypt(bulk_arg->hSession,
+					      bulk_arg->input, bulk_arg->ulInputLen,
+					      output, pulOutputLen);
+		case BulkOp::Decrypt:
+			return p11->C_Decrypt(bulk_arg->hSession,
+					      bulk_arg->input, bulk_arg->ulInputLen,
+					      output, pulOutputLen);
+		case BulkOp::Digest:
+			return p11->C_Digest(bulk_arg->hSession,
+					     bulk_arg->input, bulk_arg->ulInputLen,
+					     output, pulOutputLen);
+		case BulkOp::Mac:
+			return p11->C_Sign(bulk_arg->hSession,
+					   bulk_arg->input, bulk_arg->ulInputLen,
+					   output, pulOutputLen);
+		case BulkOp::Random:
+			*pulOutputLen = bulk_arg->ulInputLen;
+			return p11->C_GenerateRandom(bulk_arg->hSession,
+						     output, *pulOutputLen);
+		default:
+			return CKR_FUNCTION_NOT_SUPPORTED;
 	}
-	else if (keysize == 384)
+}
+
+CK_RV bulkUpdate(bulk_arg_t* bulk_arg, CK_BYTE_PTR input, CK_ULONG ulInputLen, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen)
+{
+	switch (bulk_arg->operation)
 	{
-		pukAttribs[0].pValue = oidP384;
-		pukAttribs[0].ulValueLen = sizeof(oidP384);
+		case BulkOp::Encrypt:
+			return p11->C_EncryptUpdate(bulk_arg->hSession,
+						    input, ulInputLen,
+						    output, pulOutputLen);
+		case BulkOp::Decrypt:
+			return p11->C_DecryptUpdate(bulk_arg->hSession,
+						    input, ulInputLen,
+						    output, pulOutputLen);
+		case BulkOp::Digest:
+			return p11->C_DigestUpdate(bulk_arg->hSession,
+						   input, ulInputLen);
+		case BulkOp::Mac:
+			return p11->C_SignUpdate(bulk_arg->hSession,
+						 input, ulInputLen);
+		default:
+			return CKR_FUNCTION_NOT_SUPPORTED;
 	}
-	else
+}
+
+CK_RV bulkFinal(bulk_arg_t* bulk_arg, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen)
+{
+	switch (bulk_arg->operation)
 	{
-		log_error("generateEcdsa(): Invalid curve\n");
-		return 1;
+		case BulkOp::Encrypt:
+			return p11->C_EncryptFinal(bulk_arg->hSession,
+						   output, pulOutputLen);
+		case BulkOp::Decrypt:
+			return p11->C_DecryptFinal(bulk_arg->hSession,
+						   output, pulOutputLen);
+		case BulkOp::Digest:
+			return p11->C_DigestFinal(bulk_arg->hSession,
+						  output, pulOutputLen);
+		case BulkOp::Mac:
+			return p11->C_SignFinal(bulk_arg->hSession,
+						output, pulOutputLen);
+		default:
+			return CKR_FUNCTION_NOT_SUPPORTED;
 	}
+}
 
-	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
-					  pukAttribs, 8,
-					  prkAttribs, 10,
-					  &hPuk, &hPrk);
-	if (rv != CKR_OK)
+void* bulk (void* arg)
+{
+	bulk_arg_t* bulk_arg = (bulk_arg_t*)arg;
+	unsigned int iterations = bulk_arg->iterations;
+	BulkOp::Type operation = bulk_arg->operation;
+	CK_BYTE_PTR input = bulk_arg->input;
+	CK_ULONG ulInputLen = bulk_arg->ulInputLen;
+	CK_ULONG ulChunkSize = bulk_arg->ulChunkSize;
+
+	size_t i;
+	CK_RV rv;
+	CK_ULONG ulOffset, ulLen;
+
+	// The output of each call overwrites the previous one
+	CK_ULONG ulOutputSize = (ulChunkSize > ulInputLen ? ulChunkSize : ulInputLen) +
+				BULK_OUTPUT_OVERHEAD;
+	CK_BYTE_PTR output = (CK_BYTE_PTR) malloc(ulOutputSize);
+	CK_ULONG ulOutputLen;
+
+	if (output == NULL)
 	{
-		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+		log_error("Could not allocate memory.\n");
+		pthread_exit(NULL);
 	}
 
-	return 0;
+	for (i=0; i<iterations; i++) {
+		rv = bulkInit(bulk_arg);
+		if (rv != CKR_OK)
+		{
+			log_error("%s() returned error: rv=%X\n",
+				  bulk_functions[operation][0], (unsigned int)rv);
+			if (operation == BulkOp::Encrypt && bulk_arg->id == 0)
+			{
+				logGcmIvError(bulk_arg->mechanism, rv);
+			}
+			break;
+		}
+
+		if (ulChunkSize == 0)
+		{
+			ulOutputLen = ulOutputSize;
+			rv = bulkSingle(bulk_arg, output, &ulOutputLen);
+			if (rv != CKR_OK)
+			{
+				log_error("%s() returned error: rv=%X\n",
+					  bulk_functions[operation][1], (unsigned int)rv);
+				break;
+			}
+
+			countOperation();
+			continue;
+		}
+
+		for (ulOffset=0; ulOffset<ulInputLen; ulOffset+=ulLen)
+		{
+			ulLen = ulInputLen - ulOffset;
+			if (ulLen > ulChunkSize) ulLen = ulChunkSize;
+
+			ulOutputLen = ulOutputSize;
+			rv = bulkUpdate(bulk_arg, input + ulOffset, ulLen,
+					output, &ulOutputLen);
+			if (rv != CKR_OK) break;
+		}
+		if (rv != CKR_OK)
+		{
+			log_error("%s() returned error: rv=%X\n",
+				  bulk_functions[operation][2], (unsigned int)rv);
+			break;
+		}
+
+		ulOutputLen = ulOutputSize;
+		rv = bulkFinal(bulk_arg, output, &ulOutputLen);
+		if (rv != CKR_OK)
+		{
+			log_error("%s() returned error: rv=%X\n",
+				  bulk_functions[operation][3], (unsigned int)rv);
+			break;
+		}
+
+		countOperation();
+	}
+
+	free(output);
+
+	pthread_exit(NULL);
 }
 
-int generateGost(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk)
+void* keygen (void* arg)
 {
-	CK_KEY_TYPE keyType = CKK_GOSTR3410;
+	keygen_arg_t* keygen_arg = (keygen_arg_t*)arg;
+	unsigned int iterations = keygen_arg->iterations;
+	CK_SESSION_HANDLE hSession = keygen_arg->hSession;
+	CK_KEY_TYPE keyType = keygen_arg->keyType;
+	unsigned int bits = keygen_arg->bits;
+
+	size_t i;
+	CK_RV rv;
+	CK_OBJECT_HANDLE hPublicKey, hPrivateKey;
+	double start;
+
+	/* Generate and remove the key pairs */
+	for (i=0; i<iterations; i++) {
+		start = getTime();
+		if (generateKeyPair(hSession, keyType, bits,
+				    hPublicKey, hPrivateKey))
+		{
+			break;
+		}
+		histogramRecord(keygen_arg->histogram, getTime() - start);
+		keygen_arg->generated++;
+		countOperation();
+
+		rv = p11->C_DestroyObject(hSession, hPublicKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			break;
+		}
+		rv = p11->C_DestroyObject(hSession, hPrivateKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			break;
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+void* derive (void* arg)
+{
+	derive_arg_t* derive_arg = (derive_arg_t*)arg;
+	unsigned int id = derive_arg->id;
+	unsigned int iterations = derive_arg->iterations;
+	CK_SESSION_HANDLE hSession = derive_arg->hSession;
+	CK_OBJECT_HANDLE hPrivateKey = derive_arg->hPrivateKey;
+	ec_point_t* points = derive_arg->points;
+	unsigned int pointCount = derive_arg->pointCount;
+
+	size_t i;
+	CK_RV rv;
+	CK_OBJECT_HANDLE hKey;
+	double start, derived;
+
+	CK_ECDH1_DERIVE_PARAMS params;
 	CK_MECHANISM mechanism = {
-		CKM_GOSTR3410_KEY_PAIR_GEN, NULL_PTR, 0
+		CKM_ECDH1_DERIVE, &params, sizeof(params)
 	};
-	CK_BYTE oid1[] = { 0x06, 0x07, 0x2A, 0x85, 0x03, 0x02, 0x02, 0x23, 0x01 };
-	CK_BYTE oid2[] = { 0x06, 0x07, 0x2A, 0x85, 0x03, 0x02, 0x02, 0x1E, 0x01 };
-	CK_BYTE label[] = { 0x70, 0x31, 0x31, 0x73, 0x70, 0x65, 0x65, 0x64 }; // p11speed
-	CK_BYTE id[] = { 0x12, 0x34 };
+	CK_OBJECT_CLASS keyClass = CKO_SECRET_KEY;
+	CK_KEY_TYPE keyType = CKK_GENERIC_SECRET;
+	CK_ULONG ulValueLen = DERIVE_KEY_SIZE;
 	CK_BBOOL bFalse = CK_FALSE;
 	CK_BBOOL bTrue = CK_TRUE;
-
-	CK_ATTRIBUTE pukAttribs[] = {
-		{ CKA_GOSTR3410_PARAMS, oid1,      sizeof(oid1)    },
-		{ CKA_GOSTR3411_PARAMS, oid2,      sizeof(oid2)    },
-		{ CKA_LABEL,            &label[0], sizeof(label)   },
-		{ CKA_ID,               &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,         &keyType,  sizeof(keyType) },
-		{ CKA_VERIFY,           &bTrue,    sizeof(bTrue)   },
-		{ CKA_ENCRYPT,          &bFalse,   sizeof(bFalse)  },
-		{ CKA_WRAP,             &bFalse,   sizeof(bFalse)  },
-		{ CKA_TOKEN,            &bTrue,    sizeof(bTrue)   }
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_CLASS,       &keyClass,   sizeof(keyClass)   },
+		{ CKA_KEY_TYPE,    &keyType,    sizeof(keyType)    },
+		{ CKA_VALUE_LEN,   &ulValueLen, sizeof(ulValueLen) },
+		{ CKA_TOKEN,       &bFalse,     sizeof(bFalse)     },
+		{ CKA_SENSITIVE,   &bTrue,      sizeof(bTrue)      },
+		{ CKA_EXTRACTABLE, &bFalse,     sizeof(bFalse)     }
 	};
 
-	CK_ATTRIBUTE prkAttribs[] = {
-		{ CKA_LABEL,       &label[0], sizeof(label)   },
-		{ CKA_ID,          &id[0],    sizeof(id)      },
-		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType) },
-		{ CKA_SIGN,        &bTrue,    sizeof(bTrue)   },
-		{ CKA_DECRYPT,     &bFalse,   sizeof(bFalse)  },
-		{ CKA_UNWRAP,      &bFalse,   sizeof(bFalse)  },
-		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)   },
-		{ CKA_TOKEN,       &bTrue,    sizeof(bTrue)   },
-		{ CKA_PRIVATE,     &bTrue,    sizeof(bTrue)   },
-		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)  }
-	};
+	params.kdf = CKD_NULL;
+	params.ulSharedDataLen = 0;
+	params.pSharedData = NULL_PTR;
 
-	CK_RV rv = p11->C_GenerateKeyPair(hSession, &mechanism,
-					  pukAttribs, 9,
-					  prkAttribs, 10,
-					  &hPuk, &hPrk);
-	if (rv != CKR_OK)
-	{
-		log_error("C_GenerateKeyPair() returned error: rv=%X\n",
-			  (unsigned int)rv);
-		return 1;
+	/* Derive and remove the secret keys, walk through the peer points */
+	for (i=0; i<iterations; i++) {
+		params.ulPublicDataLen = points[(id + i) % pointCount].ulPointLen;
+		params.pPublicData = points[(id + i) % pointCount].point;
+
+		start = getTime();
+		rv = p11->C_DeriveKey(hSession, &mechanism, hPrivateKey,
+				      keyAttribs, 6, &hKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DeriveKey() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			break;
+		}
+		derived = getTime();
+		histogramRecord(derive_arg->deriveHistogram, derived - start);
+		derive_arg->derived++;
+		countOperation();
+
+		// The derive time at the start and at the end of the run
+		if (i < iterations / 10)
+		{
+			derive_arg->firstTime += derived - start;
+			derive_arg->firstCount++;
+		}
+		if (i >= iterations - iterations / 10)
+		{
+			derive_arg->lastTime += derived - start;
+			derive_arg->lastCount++;
+		}
+
+		// A key that cannot be destroyed stays in the object table
+		rv = p11->C_DestroyObject(hSession, hKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
+			continue;
+		}
+		histogramRecord(derive_arg->destroyHistogram, getTime() - derived);
+		derive_arg->destroyed++;
 	}
 
-	return 0;
+	pthread_exit(NULL);
 }
 
-void* sign (void* arg)
+void* wrap (void* arg)
 {
-	sign_arg_t* sign_arg = (sign_arg_t*)arg;
-	unsigned int id = sign_arg->id;
-	unsigned int iterations = sign_arg->iterations;
-	CK_SESSION_HANDLE hSession = sign_arg->hSession;
-	CK_OBJECT_HANDLE hPrivateKey = sign_arg->hPrivateKey;
-	CK_MECHANISM_TYPE mechanismType = sign_arg->mechanismType;
-	HashAlgo::Type hashType = sign_arg->hashType;
+	wrap_arg_t* wrap_arg = (wrap_arg_t*)arg;
+	unsigned int id = wrap_arg->id;
+	unsigned int iterations = wrap_arg->iterations;
+	CK_SESSION_HANDLE hSession = wrap_arg->hSession;
+	CK_OBJECT_HANDLE hWrappingKey = wrap_arg->hWrappingKey;
+	CK_MECHANISM_PTR mechanism = wrap_arg->mechanism;
+	CK_OBJECT_HANDLE* targets = wrap_arg->targets;
+	unsigned int poolSize = wrap_arg->poolSize;
 
 	size_t i;
 	CK_RV rv;
-	CK_MECHANISM mechanism = { mechanismType, NULL_PTR, 0 };
-	// SHA256(p11speed)= f2c55b2f6a9dc972d444278810c226faf22ff96b1abd248f0118fa700e2aed72
-	CK_BYTE data256[] = { 0xf2, 0xc5, 0x5b, 0x2f, 0x6a, 0x9d, 0xc9, 0x72, 0xd4, 0x44,
-			      0x27, 0x88, 0x10, 0xc2, 0x26, 0xfa, 0xf2, 0x2f, 0xf9, 0x6b,
-			      0x1a, 0xbd, 0x24, 0x8f, 0x01, 0x18, 0xfa, 0x70, 0x0e, 0x2a,
-			      0xed, 0x72 };
-	// SHA384(p11speed)= 3aec14e31d63ff1f9b2afe7e51fa7fe79926466c80a5aea185a2112df6d31f7c7cd9fffe3bdcc04dcf02010316ab340f
-	CK_BYTE data384[] = { 0x3a, 0xec, 0x14, 0xe3, 0x1d, 0x63, 0xff, 0x1f, 0x9b, 0x2a,
-			      0xfe, 0x7e, 0x51, 0xfa, 0x7f, 0xe7, 0x99, 0x26, 0x46, 0x6c,
-			      0x80, 0xa5, 0xae, 0xa1, 0x85, 0xa2, 0x11, 0x2d, 0xf6, 0xd3,
-			      0x1f, 0x7c, 0x7c, 0xd9, 0xff, 0xfe, 0x3b, 0xdc, 0xc0, 0x4d,
-			      0xcf, 0x02, 0x01, 0x03, 0x16, 0xab, 0x34, 0x0f };
-	// GOSTR3411(p11speed)= 286e36119111e58338af8a821fff332d2211897f35dedcbaba488876b352553c
-	CK_BYTE dataGost[] = { 0x28, 0x6e, 0x36, 0x11, 0x91, 0x11, 0xe5, 0x83, 0x38, 0xaf,
-			       0x8a, 0x82, 0x1f, 0xff, 0x33, 0x2d, 0x22, 0x11, 0x89, 0x7f,
-			       0x35, 0xde, 0xdc, 0xba, 0xba, 0x48, 0x88, 0x76, 0xb3, 0x52,
-			       0x55, 0x3c };
-
-	CK_BYTE* data;
-	CK_ULONG ulDataLen = 0;
-	switch (hashType)
-	{
-		case HashAlgo::SHA256:
-		default:
-			data = data256;
-			ulDataLen = sizeof(data256);
+
+	// 4096 / 8 = 512
+	CK_BYTE wrapped[512];
+	CK_ULONG ulWrappedLen = 0;
+
+	/* Do some wrapping, walk through the target keys */
+	for (i=0; i<iterations; i++) {
+		ulWrappedLen = sizeof(wrapped);
+		rv = p11->C_WrapKey(hSession, mechanism, hWrappingKey,
+				    targets[(id + i) % poolSize],
+				    wrapped, &ulWrappedLen);
+		if (rv != CKR_OK)
+		{
+			log_error("C_WrapKey() returned error: rv=%X\n",
+				  (unsigned int)rv);
 			break;
-		case HashAlgo::SHA384:
-			data = data384;
-			ulDataLen = sizeof(data384);
+		}
+
+		countOperation();
+	}
+
+	pthread_exit(NULL);
+}
+
+void* unwrap (void* arg)
+{
+	wrap_arg_t* wrap_arg = (wrap_arg_t*)arg;
+	unsigned int id = wrap_arg->id;
+	unsigned int iterations = wrap_arg->iterations;
+	CK_SESSION_HANDLE hSession = wrap_arg->hSession;
+	CK_OBJECT_HANDLE hUnwrappingKey = wrap_arg->hUnwrappingKey;
+	CK_MECHANISM_PTR mechanism = wrap_arg->mechanism;
+	wrapped_t* wrapped = wrap_arg->wrapped;
+	unsigned int poolSize = wrap_arg->poolSize;
+
+	size_t i;
+	CK_RV rv;
+	CK_OBJECT_HANDLE hKey;
+	double start, unwrapped;
+
+	// The unwrapped keys are session objects
+	CK_OBJECT_CLASS keyClass = CKO_SECRET_KEY;
+	CK_KEY_TYPE keyType = CKK_AES;
+	CK_BBOOL bFalse = CK_FALSE;
+	CK_BBOOL bTrue = CK_TRUE;
+	CK_ATTRIBUTE keyAttribs[] = {
+		{ CKA_CLASS,       &keyClass, sizeof(keyClass) },
+		{ CKA_KEY_TYPE,    &keyType,  sizeof(keyType)  },
+		{ CKA_TOKEN,       &bFalse,   sizeof(bFalse)   },
+		{ CKA_ENCRYPT,     &bTrue,    sizeof(bTrue)    },
+		{ CKA_DECRYPT,     &bTrue,    sizeof(bTrue)    },
+		{ CKA_SENSITIVE,   &bTrue,    sizeof(bTrue)    },
+		{ CKA_EXTRACTABLE, &bFalse,   sizeof(bFalse)   }
+	};
+
+	/* Do some unwrapping, walk through the wrapped keys */
+	for (i=0; i<iterations; i++) {
+		wrapped_t* key = &wrapped[(id + i) % poolSize];
+
+		start = getTime();
+		rv = p11->C_UnwrapKey(hSession, mechanism, hUnwrappingKey,
+				      key->wrapped, key->ulWrappedLen,
+				      keyAttribs, 7, &hKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_UnwrapKey() returned error: rv=%X\n",
+				  (unsigned int)rv);
 			break;
-		case HashAlgo::GOST:
-			data = dataGost;
-			ulDataLen = sizeof(dataGost);
+		}
+		unwrapped = getTime();
+		histogramRecord(wrap_arg->unwrapHistogram, unwrapped - start);
+
+		// Keep the object table bounded
+		rv = p11->C_DestroyObject(hSession, hKey);
+		if (rv != CKR_OK)
+		{
+			log_error("C_DestroyObject() returned error: rv=%X\n",
+				  (unsigned int)rv);
 			break;
+		}
+		histogramRecord(wrap_arg->destroyHistogram, getTime() - unwrapped);
+
+		countOperation();
 	}
 
-	// 4096 / 8 = 512
-	CK_BYTE signature[512];
-	CK_ULONG ulSignatureLen = 0;
+	pthread_exit(NULL);
+}
+
+void* rsaDecrypt (void* arg)
+{
+	rsa_decrypt_arg_t* decrypt_arg = (rsa_decrypt_arg_t*)arg;
+	unsigned int id = decrypt_arg->id;
+	unsigned int iterations = decrypt_arg->iterations;
+	CK_SESSION_HANDLE hSession = decrypt_arg->hSession;
+	CK_OBJECT_HANDLE hPrivateKey = decrypt_arg->hPrivateKey;
+	CK_MECHANISM_PTR mechanism = decrypt_arg->mechanism;
+	ciphertext_t* ciphertexts = decrypt_arg->ciphertexts;
+	unsigned int ciphertextCount = decrypt_arg->ciphertextCount;
+
+	size_t i;
+	CK_RV rv;
 
-	log_notice("Signer thread #%d started...\n", id);
+	// 4096 / 8 = 512
+	CK_BYTE plaintext[512];
+	CK_ULONG ulPlaintextLen = 0;
 
-	/* Do some signing */
+	/* Do some decryption, walk through the ciphertext pool */
 	for (i=0; i<iterations; i++) {
-		rv = p11->C_SignInit(hSession, &mechanism, hPrivateKey);
+		ciphertext_t* ciphertext = &ciphertexts[(id + i) % ciphertextCount];
+
+		rv = p11->C_DecryptInit(hSession, mechanism, hPrivateKey);
 		if (rv != CKR_OK)
 		{
-			log_error("C_SignInit() returned error: rv=%X\n",
+			log_error("C_DecryptInit() returned error: rv=%X\n",
 				  (unsigned int)rv);
 			break;
 		}
 
-		ulSignatureLen = sizeof(signature);
-		rv = p11->C_Sign(hSession,
-				 data,
-				 ulDataLen,
-				 signature,
-				 &ulSignatureLen);
+		ulPlaintextLen = sizeof(plaintext);
+		rv = p11->C_Decrypt(hSession,
+				    ciphertext->ciphertext,
+				    ciphertext->ulCiphertextLen,
+				    plaintext,
+				    &ulPlaintextLen);
 		if (rv != CKR_OK)
 		{
-			log_error("C_Sign() returned error: rv=%X\n",
+			log_error("C_Decrypt() returned error: rv=%X\n",
 				  (unsigned int)rv);
 			break;
 		}
-	}
 
-	log_notice("Signer thread #%d done.\n", id);
+		countOperation();
+	}
 
 	pthread_exit(NULL);
 }
@@ -35,50 +35,532 @@
 #define _P11SPEED_H
 
 #include "pkcs11.h"
+#include "histogram.h"
+#include <pthread.h>
 
-// Main functions
-void usage();
-int showSlots();
-int testSign(unsigned int slot, char* userPIN, char* mechanism, char* keysize, unsigned int threads, unsigned int iterations);
+#define PTHREAD_THREADS_MAX 2048
+// The sign and verify threads share their histograms when there are many,
+// so they can use many more threads
+#define SIGN_THREADS_MAX 65536
+// Worker state is aligned to this, so that threads do not share cache lines
+#define CACHE_LINE_SIZE 64
+// Above this number of threads, the threads share the latency histograms
+#define HISTOGRAM_STRIPES 64
 
-// Key generation
-int generateRsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
-int generateDsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
-int generateEcdsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
-int generateGost(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+// Number of pre-computed signatures used by the verifier threads
+#define SIGNATURE_POOL_SIZE 64
 
-// Work items for threads
-void* sign(void* arg);
+// Default message size for the hash-and-sign mechanisms
+#define SIGN_DATA_SIZE 1024
+// Doubling from one thread up to SIGN_THREADS_MAX
+#define SWEEP_STEPS_MAX 17
+// The knee is where the throughput reaches this part of the peak
+#define SWEEP_KNEE 0.95
+// Largest number of sessions in the shared session pool
+#define SESSION_POOL_MAX 4096
+// A thread that finds all sessions busy yields this many times before it
+// blocks until a session is returned
+#define SESSION_POOL_SPINS 16
+// Longest block, after which the other slots are tried again
+#define SESSION_POOL_WAIT_NS 1000000
+// Largest number of keys in the key pool
+#define KEY_POOL_MAX 65536
+// Largest number of slots in a slot list
+#define SLOTS_MAX 64
+// Largest number of modules loaded at the same time
+#define MODULES_MAX 8
+// Largest number of trials per side in an A/B comparison
+#define COMPARE_TRIALS_MAX 1000
+// Largest number of worker processes
+#define PROCESSES_MAX 256
+// How long a waiting worker process sleeps before it looks for a failure
+#define PROCESS_WAIT_NS 10000000
+// Largest number of trials of the p99 tuner
+#define TUNE_TRIALS_MAX 64
+// The tuner bisects the thread count down to this part of the count
+#define TUNE_RESOLUTION 8
 
-// Logging
-void log_notice(const char* format, ...);
-void log_error(const char* format, ...);
-void log_fatal(const char* format, ...);
+// Default chunk size for multi-part operations and the largest data size
+#define BULK_CHUNK_SIZE 4096
+#define BULK_MAX_SIZE 67108864
+// Room for padding and authentication tags in the output buffers
+#define BULK_OUTPUT_OVERHEAD 64
+// AES-GCM IV, a 32 bit prefix followed by a 64 bit counter
+#define GCM_IV_SIZE 12
 
-// Library
-static void* moduleHandle;
-extern CK_FUNCTION_LIST_PTR p11;
+// Default HMAC key size in bits
+#define HMAC_KEY_SIZE 256
 
-#define PTHREAD_THREADS_MAX 2048
+// Largest request size in the default random sweep
+#define RANDOM_MAX_SIZE 1048576
+
+// Number of peer public points used by the derive threads
+#define PEER_POOL_SIZE 16
+// Size of the derived secret keys in bytes
+#define DERIVE_KEY_SIZE 32
+// Uncompressed point on P-384
+#define EC_POINT_MAX_SIZE 97
+
+// Number of target keys used by the wrap and unwrap threads
+#define WRAP_POOL_SIZE 16
+// Size of the target keys in bits
+#define WRAP_TARGET_SIZE 256
+
+// Number of pre-computed ciphertexts used by the RSA decrypt threads
+#define CIPHERTEXT_POOL_SIZE 64
+// Size of the RSA plaintexts in bytes, like an AES-256 key
+#define RSA_PLAINTEXT_SIZE 32
+
+struct KeyDist
+{
+	enum Type
+	{
+		RoundRobin,
+		Uniform,
+		Zipf
+	};
+};
 
 struct HashAlgo
 {
         enum Type
         {
                 Unknown,
+                None,
                 SHA256,
                 SHA384,
                 GOST
         };
 };
 
+// What a generated key will be used for
+struct KeyUsage
+{
+	enum Type
+	{
+		Sign,
+		Encrypt,
+		Wrap,
+		// Encrypt, and the key can be wrapped
+		Export
+	};
+};
+
+struct BulkOp
+{
+	enum Type
+	{
+		Encrypt,
+		Decrypt,
+		Digest,
+		Mac,
+		Random
+	};
+};
+
+typedef struct {
+	// 4096 / 8 = 512
+	CK_BYTE signature[512];
+	CK_ULONG ulSignatureLen;
+} signature_t;
+
+// Sessions shared by the threads, a thread takes a session by setting
+// its busy flag. Threads that wait for a session block on the condition.
+typedef struct {
+	CK_SESSION_HANDLE* sessions;
+	volatile int* busy;
+	unsigned int count;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	volatile unsigned int waiters;
+	// Sessions that are checked out, for picking the least busy slot
+	volatile unsigned int inFlight;
+} session_pool_t;
+
+// Key pairs used by the sign and verify threads
 typedef struct {
+	CK_OBJECT_HANDLE* hPublicKeys;
+	CK_OBJECT_HANDLE* hPrivateKeys;
+	unsigned int count;
+	KeyDist::Type distribution;
+	double exponent;
+	// Cumulative probability per key for the Zipf distribution
+	double* cdf;
+} key_pool_t;
+
+// A slot used by the sign and verify threads, with its own keys,
+// signatures and sessions
+typedef struct {
+	CK_FUNCTION_LIST_PTR p11;
+	CK_SLOT_ID slotID;
+	CK_SESSION_HANDLE hSessionRW;
+	key_pool_t keys;
+	signature_t* signatures;
+	unsigned int signatureCount;
+	session_pool_t pool;
+	// Operations left in the queue of the slot, only used with iterations
+	volatile long remaining;
+	volatile unsigned long counted;
+} sign_slot_t;
+
+// A loaded PKCS#11 library with the slots that are used in it
+typedef struct {
+	char* path;
+	void* handle;
+	CK_FUNCTION_LIST_PTR p11;
+	CK_SLOT_ID slotList[SLOTS_MAX];
+	unsigned int slotCount;
+} module_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
 	unsigned int id;
 	unsigned int iterations;
+	// Each module has its own threads, which only use its function list
+	CK_FUNCTION_LIST_PTR p11;
+	module_t* modules;
+	unsigned int moduleCount;
+	unsigned int moduleIndex;
 	CK_SESSION_HANDLE hSession;
-	CK_OBJECT_HANDLE hPrivateKey;
-	CK_MECHANISM_TYPE mechanismType;
-	HashAlgo::Type hashType;
+	key_pool_t* keys;
+	unsigned int keyCursor;
+	unsigned long long random;
+	CK_MECHANISM_PTR mechanism;
+	CK_BYTE_PTR data;
+	CK_ULONG ulDataLen;
+	CK_ULONG ulChunkSize; // 0 means single-part
+	signature_t* signatures;
+	unsigned int signatureCount;
+	// Measured window in getTime() seconds, relative to the start of the
+	// threads until startSignPhase(). No deadline means iterations.
+	double warmupEnd;
+	double deadline;
+	unsigned long counted;
+	// Open-loop timetable, no interval means closed-loop
+	double start;
+	double offset;
+	double interval;
+	// Latency of each counted operation, from the intended start time
+	// in open-loop mode
+	struct histogram_t* histogram;
+	// The same operations split into the init call and the sign or verify
+	// calls, with the total time of each part
+	struct histogram_t* initHistogram;
+	struct histogram_t* callHistogram;
+	// The histograms are shared with other threads
+	int histogramShared;
+	// The thread stopped on an error
+	int failed;
+	double initTime;
+	double callTime;
+	// Shared sessions of the home slot, no pool means hSession is used by
+	// this thread only
+	session_pool_t* homePool;
+	// The pool of the checked out session, which can be of another slot
+	session_pool_t* pool;
+	unsigned int poolIndex;
+	unsigned int poolCursor;
+	unsigned long poolCheckouts;
+	unsigned long poolWaits;
+	// With more than one slot, the thread works on its home slot and
+	// steals work from the other slots when the home slot has none
+	sign_slot_t* slots;
+	unsigned int slotCount;
+	unsigned int home;
+	unsigned int slotIndex;
+	unsigned long stolen;
 } sign_arg_t;
 
+// The threads wait here until all of them have been created. The window
+// where all threads are running opens when the last thread has started
+// and closes when the first thread stops.
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int waiting;
+	unsigned int threads;
+	int open;
+	int aborted;
+	volatile unsigned int running;
+	volatile int windowOpen;
+	volatile int windowClosed;
+	double windowStart;
+	double windowStop;
+} start_gate_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	void* (*worker)(void*);
+	void* arg;
+	start_gate_t* gate;
+	double started;
+	double stopped;
+	// Operations completed while all threads were running
+	unsigned long counted;
+	// All operations completed
+	unsigned long completed;
+} thread_start_t;
+
+// Spread of the start and the stop times of the threads
+typedef struct {
+	double rampUp;
+	double rampDown;
+	// From the start of the first thread to the stop of the last thread
+	double elapsed;
+	// While all threads were running, and the operations completed in it
+	double windowStart;
+	double windowStop;
+	unsigned long counted;
+} thread_times_t;
+
+typedef struct {
+	unsigned int threads;
+	unsigned int sessions;
+	double throughput;
+	double p50;
+	double p99;
+} phase_result_t;
+
+// Result of the sign or verify phase of a worker process
+typedef struct {
+	int done;
+	unsigned int threads;
+	unsigned long counted;
+	double throughput;
+	// The measured span of the process, and the operations counted in it
+	double windowStart;
+	double windowStop;
+	unsigned long windowCounted;
+	histogram_t histogram;
+} process_phase_t;
+
+// Shared memory of the worker processes and the parent. A phase starts when
+// all processes have arrived, or stops waiting when a process has failed.
+typedef struct {
+	unsigned int processes;
+	// Process-shared, the processes wait for each other on the cond
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	volatile int arrived[2];
+	volatile int failed;
+	// What was measured, written by each process
+	char label[2][16];
+	char operation[2][32];
+	char unit[2][16];
+	char description[2][256];
+	// Two phases per process
+	process_phase_t* results;
+} process_share_t;
+
+// The worker process this is, no share means a single process
+typedef struct {
+	process_share_t* share;
+	unsigned int index;
+	unsigned int phase;
+} sign_process_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	unsigned int id;
+	unsigned int iterations;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hKey;
+	CK_MECHANISM_PTR mechanism;
+	BulkOp::Type operation;
+	CK_BYTE_PTR input;
+	CK_ULONG ulInputLen;
+	// Zero for single-part operations
+	CK_ULONG ulChunkSize;
+	// AES-GCM encryption takes a new IV for every operation
+	CK_MECHANISM gcmMechanism;
+	CK_GCM_PARAMS gcmParams;
+	CK_BYTE gcmIv[GCM_IV_SIZE];
+	unsigned long gcmCounter;
+} bulk_arg_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	unsigned int id;
+	unsigned int iterations;
+	CK_SESSION_HANDLE hSession;
+	CK_KEY_TYPE keyType;
+	unsigned int bits;
+	// The latency histogram of the thread
+	struct histogram_t* histogram;
+	unsigned int generated;
+} keygen_arg_t;
+
+typedef struct {
+	CK_BYTE point[EC_POINT_MAX_SIZE];
+	CK_ULONG ulPointLen;
+} ec_point_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	unsigned int id;
+	unsigned int iterations;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hPrivateKey;
+	ec_point_t* points;
+	unsigned int pointCount;
+	// The latency histograms of the thread
+	struct histogram_t* deriveHistogram;
+	struct histogram_t* destroyHistogram;
+	// Derive time of the first and the last tenth of the iterations
+	double firstTime;
+	double lastTime;
+	unsigned int firstCount;
+	unsigned int lastCount;
+	unsigned int derived;
+	unsigned int destroyed;
+} derive_arg_t;
+
+typedef struct {
+	// 4096 / 8 = 512
+	CK_BYTE wrapped[512];
+	CK_ULONG ulWrappedLen;
+} wrapped_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	unsigned int id;
+	unsigned int iterations;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hWrappingKey;
+	CK_OBJECT_HANDLE hUnwrappingKey;
+	CK_MECHANISM_PTR mechanism;
+	CK_OBJECT_HANDLE* targets;
+	wrapped_t* wrapped;
+	unsigned int poolSize;
+	// The unwrap threads time the removal of the key on its own
+	histogram_t* unwrapHistogram;
+	histogram_t* destroyHistogram;
+} wrap_arg_t;
+
+typedef struct {
+	// 4096 / 8 = 512
+	CK_BYTE ciphertext[512];
+	CK_ULONG ulCiphertextLen;
+} ciphertext_t;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) {
+	unsigned int id;
+	unsigned int iterations;
+	CK_SESSION_HANDLE hSession;
+	CK_OBJECT_HANDLE hPrivateKey;
+	CK_MECHANISM_PTR mechanism;
+	ciphertext_t* ciphertexts;
+	unsigned int ciphertextCount;
+} rsa_decrypt_arg_t;
+
+// Main functions
+void usage();
+int showSlots();
+int loadModules(module_t* moduleList, unsigned int moduleCount);
+void unloadModules(module_t* moduleList, unsigned int moduleCount);
+int startProcesses(unsigned int processes, module_t* moduleList, unsigned int moduleCount, char* &userPIN);
+void printProcesses(process_share_t* share);
+int waitForProcesses();
+void failProcesses(process_share_t* share);
+void storeProcessResult(unsigned int threads, unsigned long counted, double throughput, thread_times_t* window, histogram_t* histogram, const char* label, const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details);
+int testSign(module_t* moduleList, unsigned int moduleCount, char* userPIN, char* mechanism, char* keysize, char* datasize, char* chunksize, unsigned int threads, unsigned int sweepMin, unsigned int trials, double target, unsigned int sessions, unsigned int keys, char* distribution, unsigned int iterations, double duration, double warmup, double rate, int doSign, int doVerify);
+int testCipher(unsigned int slot, char* userPIN, char* mechanism, char* keysize, char* datasize, char* chunksize, unsigned int threads, unsigned int iterations, int doEncrypt, int doDecrypt);
+int testKeygen(unsigned int slot, char* userPIN, char* mechanism, char* keysize, unsigned int threads, unsigned int iterations);
+int testHash(unsigned int slot, char* userPIN, char* mechanism, char* keysize, char* datasize, char* chunksize, unsigned int threads, unsigned int iterations, BulkOp::Type operation);
+int testDerive(unsigned int slot, char* userPIN, char* mechanism, char* keysize, unsigned int threads, unsigned int iterations);
+int testRandom(unsigned int slot, char* datasize, unsigned int threads, unsigned int iterations);
+int testRsaDecrypt(unsigned int slot, char* userPIN, char* mechanism, char* keysize, char* oaephash, char* oaepmgf, unsigned int threads, unsigned int iterations);
+int testWrap(unsigned int slot, char* userPIN, char* mechanism, char* keysize, char* oaephash, char* oaepmgf, unsigned int threads, unsigned int iterations, int doWrap, int doUnwrap);
+
+// Key generation
+int generateRsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk, KeyUsage::Type usage);
+int generateDsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+int generateEcdsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+int generateEddsa(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+int generateEcdh(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+int generateGost(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+int generateAes(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hKey, KeyUsage::Type usage);
+int generateGenericSecret(CK_SESSION_HANDLE hSession, CK_ULONG keysize, CK_OBJECT_HANDLE &hKey);
+
+// Work items for threads
+void* sign(void* arg);
+void* verify(void* arg);
+void* bulk(void* arg);
+void* keygen(void* arg);
+void* derive(void* arg);
+void* wrap(void* arg);
+void* unwrap(void* arg);
+void* rsaDecrypt(void* arg);
+
+// Logging
+void log_notice(const char* format, ...);
+void log_error(const char* format, ...);
+void log_fatal(const char* format, ...);
+
+// Library
+extern CK_FUNCTION_LIST_PTR p11;
+
+// Helpers
+int openSession(unsigned int slot, char* userPIN, CK_SESSION_HANDLE &hSession);
+int getSignMechanism(char* mechanism, char* keysize, CK_MECHANISM_TYPE &mechanismType, CK_KEY_TYPE &keyType, HashAlgo::Type &hashType, unsigned int &bits);
+void getPssParams(CK_MECHANISM_TYPE mechanismType, CK_RSA_PKCS_PSS_PARAMS &params);
+int generateKeyPair(CK_SESSION_HANDLE hSession, CK_KEY_TYPE keyType, unsigned int bits, CK_OBJECT_HANDLE &hPuk, CK_OBJECT_HANDLE &hPrk);
+void getSignData(HashAlgo::Type hashType, CK_BYTE_PTR &data, CK_ULONG &ulDataLen);
+void* allocThreadArgs(unsigned int count, size_t argSize);
+int setStackSize(char* stacksize);
+int runThreads(void* (*worker)(void*), void* args, size_t argSize, unsigned int threads, int window, double &throughput, void (*prepare)(void*, unsigned int, double), thread_times_t* times);
+void* startThread(void* arg);
+void stopThread(void* arg);
+void countOperation(void);
+void openGate(start_gate_t* gate, unsigned int threads, int aborted);
+void startSignPhase(void* args, unsigned int threads, double start);
+int openSessionPool(unsigned int slot, unsigned int sessions, session_pool_t &pool);
+void freeSessionPool(session_pool_t &pool);
+int takeSession(sign_arg_t* sign_arg, session_pool_t* pool);
+unsigned int leastBusySlot(sign_arg_t* sign_arg);
+int checkoutSession(sign_arg_t* sign_arg);
+void waitForSession(session_pool_t* pool);
+void releaseSession(sign_arg_t* sign_arg);
+void printSessionPool(sign_arg_t* sign_arg_array, unsigned int threads);
+int getSlotList(char* slot, CK_SLOT_ID* slotList, unsigned int &slotCount);
+int openSignSlot(sign_slot_t* signSlot, char* userPIN, CK_KEY_TYPE keyType, unsigned int bits, unsigned int keys);
+int makeSignatures(sign_slot_t* signSlot, CK_MECHANISM_PTR mechanism, CK_BYTE_PTR data, CK_ULONG ulDataLen, unsigned int count, int doVerify);
+int closeSignSlots(sign_slot_t* signSlots, unsigned int slotCount);
+void printSignSlots(sign_arg_t* sign_arg_array, unsigned int threads, const char* operation, const char* unit, double elapsed);
+void printSignModules(sign_arg_t* sign_arg_array, unsigned int threads, const char* operation, const char* unit, double elapsed);
+const char* getModuleName(module_t* module);
+int getKeyDistribution(char* distribution, KeyDist::Type &type, double &exponent);
+int generateKeyPool(CK_SESSION_HANDLE hSession, CK_KEY_TYPE keyType, unsigned int bits, unsigned int keys, key_pool_t &keyPool);
+int destroyKeyPool(CK_SESSION_HANDLE hSession, key_pool_t &keyPool);
+unsigned long long nextRandom(unsigned long long &state);
+unsigned int selectKey(sign_arg_t* sign_arg);
+int runSignPhase(void* (*worker)(void*), sign_arg_t* sign_arg_array, unsigned int threads, unsigned int iterations, double duration, double warmup, double rate, const char* label, const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details, phase_result_t* phaseResult);
+int getSweepRange(char* sweep, unsigned int &sweepMin, unsigned int &sweepMax);
+int runSignSweep(void* (*worker)(void*), sign_arg_t* sign_arg_array, unsigned int sweepMin, unsigned int sweepMax, unsigned int iterations, double duration, double warmup, const char* label, const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details);
+int runSignTune(void* (*worker)(void*), sign_arg_t* sign_arg_array, sign_slot_t* signSlots, unsigned int slotCount, unsigned int moduleCount, unsigned int maxThreads, double target, unsigned int iterations, double duration, double warmup, const char* label, const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details);
+void setSessionCount(sign_slot_t* signSlots, unsigned int slotCount, unsigned int sessions);
+int runSignCompare(void* (*worker)(void*), sign_arg_t* sideA, sign_arg_t* sideB, unsigned int threads, unsigned int trials, unsigned int iterations, double duration, double warmup, double rate, const char* label, const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details);
+double getStudentT(unsigned int df);
+int signData(sign_arg_t* sign_arg);
+int verifyData(sign_arg_t* sign_arg, signature_t* signature);
+double waitForSchedule(sign_arg_t* sign_arg, size_t i);
+int countInWindow(sign_arg_t* sign_arg, double started, double initStarted, double initDone);
+void printInitShare(sign_arg_t* sign_arg_array, unsigned int threads, const char* label, struct histogram_t* initHistogram, struct histogram_t* callHistogram);
+void printSignResult(const char* operation, const char* unit, char* mechanism, unsigned int bits, const char* details, unsigned int threads, unsigned int iterations, double speed);
+int getCipherMechanism(char* mechanism, char* keysize, CK_MECHANISM_TYPE &mechanismType, unsigned int &bits);
+int getBulkSizes(char* datasize, char* chunksize, CK_ULONG* sizes, unsigned int &sizeCount, CK_ULONG &ulChunkSize, CK_ULONG ulBlockSize);
+int getHashMechanism(char* mechanism, BulkOp::Type operation, CK_MECHANISM_TYPE &mechanismType);
+int openBulkSessions(unsigned int slot, bulk_arg_t* bulk_arg_array, unsigned int threads, unsigned int iterations, CK_OBJECT_HANDLE hKey, CK_MECHANISM_PTR mechanism);
+int runBulk(bulk_arg_t* bulk_arg_array, unsigned int threads, unsigned int iterations, BulkOp::Type operation, CK_BYTE_PTR input, CK_ULONG ulInputLen, CK_ULONG ulChunkSize, char* mechanism, unsigned int bits, double &speedSingle);
+int runBulkSweep(bulk_arg_t* bulk_arg_array, CK_SESSION_HANDLE hSession, unsigned int threads, unsigned int iterations, BulkOp::Type operation, CK_ULONG* sizes, unsigned int sizeCount, CK_ULONG ulChunkSize, char* mechanism, unsigned int bits);
+void printBulkResult(BulkOp::Type operation, char* mechanism, unsigned int bits, unsigned int threads, unsigned int iterations, CK_ULONG ulDataLen, CK_ULONG ulChunkSize, double speed);
+void printBulkCrossover(BulkOp::Type operation, CK_ULONG* sizes, double* opTimes, unsigned int sizeCount);
+void setGcmIv(CK_BYTE_PTR iv, unsigned int prefix, unsigned long counter);
+CK_MECHANISM_PTR nextGcmIv(bulk_arg_t* bulk_arg);
+void logGcmIvError(CK_MECHANISM_PTR mechanism, CK_RV rv);
+CK_RV bulkInit(bulk_arg_t* bulk_arg);
+CK_RV bulkSingle(bulk_arg_t* bulk_arg, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen);
+CK_RV bulkUpdate(bulk_arg_t* bulk_arg, CK_BYTE_PTR input, CK_ULONG ulInputLen, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen);
+CK_RV bulkFinal(bulk_arg_t* bulk_arg, CK_BYTE_PTR output, CK_ULONG_PTR pulOutputLen);
+double getTime();
+void sleepUntil(double time);
+int countObjects(CK_SESSION_HANDLE hSession, CK_ULONG &count);
+int getEcPoint(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hPuk, ec_point_t &point);
+int getOaepParams(char* oaephash, char* oaepmgf, CK_RSA_PKCS_OAEP_PARAMS &params);
+int getWrapMechanism(char* mechanism, char* keysize, CK_MECHANISM_TYPE &mechanismType, unsigned int &bits);
+
 #endif // !_P11SPEED_H
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2015 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ placement.cpp
+
+ CPU affinity and scheduling of the worker threads
+ *****************************************************************************/
+
+#include <config.h>
+#include "placement.h"
+#include "p11speed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+static CpuSpread::Type spread = CpuSpread::None;
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+// The threads take the CPU sets round-robin
+static cpu_set_t* cpuSets = NULL;
+#endif
+// The CPU or NUMA node behind each CPU set
+static int* cpuSetIds = NULL;
+static unsigned int cpuSetCount = 0;
+static int fifoPriority = 0;
+static int niceLevel = 0;
+static int doNice = 0;
+
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+// Parse a list like "0-3,8,10-11", keeping the given order
+static int parseCpuList(const char* list, int* cpus, unsigned int &count)
+{
+	const char* p = list;
+	char* end;
+	unsigned long first, last, cpu;
+
+	count = 0;
+	while (*p != '\0' && *p != '\n')
+	{
+		first = strtoul(p, &end, 10);
+		if (end == p) return 1;
+
+		last = first;
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first) return 1;
+		}
+
+		for (cpu = first; cpu <= last; cpu++)
+		{
+			if (cpu >= CPU_SETSIZE || count >= CPU_SETSIZE) return 1;
+			cpus[count++] = cpu;
+		}
+
+		if (*end == ',') end++;
+		else if (*end != '\0' && *end != '\n') return 1;
+		p = end;
+	}
+
+	return (count == 0);
+}
+
+// The lowest numbered hardware thread on the same core
+static int getFirstSibling(int cpu)
+{
+	char path[128];
+	FILE* file;
+	int first;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+	file = fopen(path, "r");
+	if (file == NULL) return cpu;
+	if (fscanf(file, "%d", &first) != 1) first = cpu;
+	fclose(file);
+
+	return first;
+}
+
+// Read the CPUs of a NUMA node, returns non-zero if the node does not exist
+static int getNodeCpus(int node, int* cpus, unsigned int &count)
+{
+	char path[128];
+	char list[4096];
+	FILE* file;
+	int result = 1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	file = fopen(path, "r");
+	if (file == NULL) return 1;
+	if (fgets(list, sizeof(list), file) != NULL)
+	{
+		result = parseCpuList(list, cpus, count);
+	}
+	fclose(file);
+
+	return result;
+}
+
+// Fill the CPU sets for the chosen placement, using only the allowed CPUs
+static int getCpuSets(char* cpulist, const cpu_set_t &allowed)
+{
+	int cpus[CPU_SETSIZE];
+	unsigned int count, n, pass;
+	int cpu, node;
+
+	cpuSets = (cpu_set_t*) malloc(sizeof(cpu_set_t) * CPU_SETSIZE);
+	cpuSetIds = (int*) malloc(sizeof(int) * CPU_SETSIZE);
+	if (cpuSets == NULL || cpuSetIds == NULL)
+	{
+		log_error("Could not allocate memory.\n");
+		return 1;
+	}
+
+	switch (spread)
+	{
+		case CpuSpread::List:
+			if (parseCpuList(cpulist, cpus, count))
+			{
+				log_error("Invalid CPU list: %s\n", cpulist);
+				return 1;
+			}
+			for (n = 0; n < count; n++)
+			{
+				if (!CPU_ISSET(cpus[n], &allowed))
+				{
+					log_error("CPU %d is not available\n", cpus[n]);
+					return 1;
+				}
+				CPU_ZERO(&cpuSets[n]);
+				CPU_SET(cpus[n], &cpuSets[n]);
+				cpuSetIds[n] = cpus[n];
+			}
+			cpuSetCount = count;
+			break;
+		case CpuSpread::Core:
+			// One hardware thread of each core first, then the SMT siblings
+			for (pass = 0; pass < 2; pass++)
+			{
+				for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+				{
+					if (!CPU_ISSET(cpu, &allowed)) continue;
+					if ((getFirstSibling(cpu) == cpu) != (pass == 0)) continue;
+
+					CPU_ZERO(&cpuSets[cpuSetCount]);
+					CPU_SET(cpu, &cpuSets[cpuSetCount]);
+					cpuSetIds[cpuSetCount++] = cpu;
+				}
+			}
+			break;
+		case CpuSpread::Numa:
+			// Each thread may run on all the CPUs of its node
+			for (node = 0; node < PLACEMENT_NODES_MAX; node++)
+			{
+				if (getNodeCpus(node, cpus, count)) continue;
+
+				CPU_ZERO(&cpuSets[cpuSetCount]);
+				for (n = 0; n < count; n++)
+				{
+					if (CPU_ISSET(cpus[n], &allowed))
+					{
+						CPU_SET(cpus[n], &cpuSets[cpuSetCount]);
+					}
+				}
+				if (CPU_COUNT(&cpuSets[cpuSetCount]) == 0) continue;
+
+				cpuSetIds[cpuSetCount++] = node;
+			}
+			break;
+		default:
+			break;
+	}
+
+	if (cpuSetCount == 0)
+	{
+		log_error("No CPUs found for the placement\n");
+		return 1;
+	}
+
+	return 0;
+}
+#endif
+
+// Check and remember the placement options. The nice level is set directly
+// and is inherited by the threads created afterwards.
+int setPlacement(char* cpulist, char* cpuspread, char* schedfifo, char* nicelevel)
+{
+	char* end;
+	long value;
+
+	if (cpulist != NULL && cpuspread != NULL)
+	{
+		log_error("Use either --cpu-list or --cpu-spread\n");
+		return 1;
+	}
+
+	if (cpulist != NULL)
+	{
+		spread = CpuSpread::List;
+	}
+	else if (cpuspread != NULL)
+	{
+		if (strcmp(cpuspread, "core") == 0)
+		{
+			spread = CpuSpread::Core;
+		}
+		else if (strcmp(cpuspread, "numa") == 0)
+		{
+			spread = CpuSpread::Numa;
+		}
+		else
+		{
+			log_error("Unknown CPU spread: %s [core, numa]\n", cpuspread);
+			return 1;
+		}
+	}
+
+	if (spread != CpuSpread::None)
+	{
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+		cpu_set_t allowed;
+
+		if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		{
+			log_error("sched_getaffinity() failed: %s\n", strerror(errno));
+			return 1;
+		}
+		if (getCpuSets(cpulist, allowed)) return 1;
+#else
+		log_error("CPU affinity is not supported on this platform\n");
+		return 1;
+#endif
+	}
+
+	if (schedfifo != NULL)
+	{
+		value = strtol(schedfifo, &end, 10);
+		if (*end != '\0' ||
+		    value < sched_get_priority_min(SCHED_FIFO) ||
+		    value > sched_get_priority_max(SCHED_FIFO))
+		{
+			log_error("Invalid SCHED_FIFO priority: %s [%i-%i]\n",
+				  schedfifo, sched_get_priority_min(SCHED_FIFO),
+				  sched_get_priority_max(SCHED_FIFO));
+			return 1;
+		}
+		fifoPriority = value;
+	}
+
+	if (nicelevel != NULL)
+	{
+		value = strtol(nicelevel, &end, 10);
+		if (*end != '\0' || value < -20 || value > 19)
+		{
+			log_error("Invalid nice level: %s [-20-19]\n", nicelevel);
+			return 1;
+		}
+		if (setpriority(PRIO_PROCESS, 0, value))
+		{
+			log_error("setpriority() failed: %s\n", strerror(errno));
+			return 1;
+		}
+		niceLevel = value;
+		doNice = 1;
+	}
+
+	return 0;
+}
+
+// Set the CPU affinity and the scheduling of thread number n
+int placeThread(pthread_attr_t* attr, unsigned int n)
+{
+	struct sched_param param;
+	int result = 0;
+
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+	if (cpuSetCount)
+	{
+		result = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t),
+						     &cpuSets[n % cpuSetCount]);
+		if (result)
+		{
+			log_error("pthread_attr_setaffinity_np() returned %d\n", result);
+			return 1;
+		}
+	}
+#else
+	(void)n;
+#endif
+
+	if (fifoPriority)
+	{
+		param.sched_priority = fifoPriority;
+		result = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		if (!result) result = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+		if (!result) result = pthread_attr_setschedparam(attr, &param);
+		if (result)
+		{
+			log_error("Could not set SCHED_FIFO: %s\n", strerror(result));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Record the placement in the output, if any was chosen
+void printPlacement()
+{
+	unsigned int n;
+
+	if (spread == CpuSpread::None && !fifoPriority && !doNice) return;
+
+	printf("Placement:");
+	switch (spread)
+	{
+		case CpuSpread::List:
+		case CpuSpread::Core:
+			printf(" threads pinned round-robin to CPU%s",
+			       (cpuSetCount > 1 ? "s" : ""));
+			break;
+		case CpuSpread::Numa:
+			printf(" threads spread round-robin over NUMA node%s",
+			       (cpuSetCount > 1 ? "s" : ""));
+			break;
+		default:
+			printf(" threads not pinned");
+			break;
+	}
+	for (n = 0; n < cpuSetCount; n++)
+	{
+		printf("%s%d", (n ? "," : " "), cpuSetIds[n]);
+	}
+	if (spread == CpuSpread::Core) printf(" (spread over cores)");
+	if (fifoPriority) printf(", SCHED_FIFO priority %d", fifoPriority);
+	if (doNice) printf(", nice %d", niceLevel);
+	printf("\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2015 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*****************************************************************************
+ placement.h
+
+ CPU affinity and scheduling of the worker threads
+ *****************************************************************************/
+
+#ifndef _P11SPEED_PLACEMENT_H
+#define _P11SPEED_PLACEMENT_H
+
+#include <pthread.h>
+
+// Highest NUMA node number that is looked up in sysfs
+#define PLACEMENT_NODES_MAX 256
+
+struct CpuSpread
+{
+        enum Type
+        {
+                None,
+                List,
+                Core,
+                Numa
+        };
+};
+
+int setPlacement(char* cpulist, char* cpuspread, char* schedfifo, char* nicelevel);
+int placeThread(pthread_attr_t* attr, unsigned int n);
+void printPlacement();
+
+#endif // !_P11SPEED_PLACEMENT_H